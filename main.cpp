@@ -23,9 +23,47 @@
 #include <FL/Fl_Window.H>
 #include <FL/Fl_Scrollbar.H>
 
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cerrno>
+#include <climits>
 #include <chrono>
+#include <condition_variable>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <cmath>
+#include <cstdint>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <string>
+#include <future>
+#include <type_traits>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define TILES_HAVE_SSE2 1
+#if defined(__GNUC__)
+#define TILES_HAVE_AVX2 1 // Compiled with a target attribute, selected at runtime
+#endif
+#endif
+
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -36,128 +74,3355 @@ const int MAP_WIDTH = 10000;
 const int MAP_HEIGHT = 10000;
 const int TILES_PER_ROW = 8;
 const float MIN_VISIBLE_PIXELS = 4.0f;
+const int CHUNK_SIZE = 64;                // Sampled tiles per chunk side in the display-list cache
+const int MAP_CHUNK_SHIFT = 6;            // Storage chunks are 2^6 = 64 tiles on a side
+const int MAP_CHUNK_SIZE = 1 << MAP_CHUNK_SHIFT;
+const size_t DEFAULT_CHUNK_BUDGET = 512;  // Display lists kept before the least recently used is evicted
+const double STATS_INTERVAL = 1.0;        // Seconds between frame statistics reports
+const int PYRAMID_PAGE_SIZE = 256;        // Texels per side of an LOD pyramid texture page (power of two for GL 1.1)
+const size_t PYRAMID_PAGE_BUDGET = 128;   // Pyramid pages kept as textures
+const int PARALLEL_MIN_TILES = 16384;     // Below this many quads, vertex generation stays on the GL thread
+const int BANDS_PER_THREAD = 4;           // Row bands per worker, so uneven bands still balance out
+const size_t STREAM_RESIDENT_BUDGET = 1024; // Decoded chunks the streamer keeps resident (8 KB each)
+const float PREFETCH_SECONDS = 0.5f;      // How far ahead of the current pan chunks are prefetched
+const double PAN_IDLE_SECONDS = 0.1;      // A drag that has not moved for this long counts as stopped
+const size_t HOT_CHUNK_BUDGET = 256;      // Compressed chunks kept decompressed for reading
+const int TILE_GUTTER = TILE_SIZE / 2;    // Edge texels repeated around each tile in the atlas, so filtering never reaches a neighbour
+const int ATLAS_CELL = TILE_SIZE + 2 * TILE_GUTTER; // Atlas cell per tile; a power of two, so cells stay aligned in every mip level
+static_assert((ATLAS_CELL & (ATLAS_CELL - 1)) == 0, "atlas cells must be a power of two");
+const size_t FRAME_HISTORY = 512;         // Frame times kept for percentiles and the HUD graph (power of two)
+const size_t TRACE_EVENTS_PER_THREAD = 1 << 16; // Trace ring per thread (power of two), with -DTILES_TRACE
+const double TILESET_RELOAD_DELAY = 0.2;  // Seconds a changed tileset must settle before it is reloaded
+const double TILESET_POLL_INTERVAL = 1.0; // Seconds between modification-time checks where inotify is missing
+const double MICROBENCH_SECONDS = 0.05;   // Minimum time each --microbench case is repeated for
+static_assert(CHUNK_SIZE == MAP_CHUNK_SIZE, "a full-detail display list must cover exactly one streamed chunk");
+
+class TilemapScrollView; // Forward declare
+
+// Tile index as handed to the renderer, whatever width the map stores it at
+using TileId = uint16_t;
+
+// In-memory layout of tile indices. When Bits matches the width of Word, indices are stored
+// one per word; otherwise Word must be a byte and indices are packed back to back, so a value
+// may straddle a byte boundary.
+template <typename Word, int Bits = int(sizeof(Word) * 8)>
+struct TileCodec {
+    using WordType = Word;
+    static constexpr int bits = Bits;
+    static constexpr bool packed = Bits < int(sizeof(Word) * 8);
+    static constexpr unsigned maxTiles = 1u << Bits;
+    static_assert(!packed || (std::is_same<Word, uint8_t>::value && Bits <= 16),
+                  "packed indices are read through a three-byte window");
+    static_assert(Bits <= 16, "decoded tile indices are 16 bits wide");
+
+    // Words needed for `count` indices (packed layouts get two bytes of padding so the
+    // three-byte window never reads past the end)
+    static size_t wordCount(size_t count) {
+        return packed ? (count * Bits + 7) / 8 + 2 : count;
+    }
+
+    static unsigned get(const Word* data, size_t i) {
+        if constexpr (!packed) {
+            return data[i];
+        } else {
+            size_t bit = i * Bits;
+            return (readWindow(data + bit / 8) >> (bit % 8)) & (maxTiles - 1);
+        }
+    }
+
+    static void set(Word* data, size_t i, unsigned value) {
+        if constexpr (!packed) {
+            data[i] = (Word)value;
+        } else {
+            size_t bit = i * Bits;
+            uint8_t* p = data + bit / 8;
+            uint32_t mask = (maxTiles - 1) << (bit % 8);
+            uint32_t window = (readWindow(p) & ~mask) | ((value << (bit % 8)) & mask);
+            p[0] = (uint8_t)window;
+            p[1] = (uint8_t)(window >> 8);
+            p[2] = (uint8_t)(window >> 16);
+        }
+    }
+
+    // Decodes `count` indices starting at `first`, taking every `stride`th one
+    static void decode(const Word* data, size_t first, int count, int stride, TileId* out) {
+        if constexpr (!packed) {
+            const Word* in = data + first;
+            for (int i = 0; i < count; ++i)
+                out[i] = (TileId)in[(size_t)i * stride];
+        } else {
+            size_t bit = first * Bits;
+            size_t bitStep = (size_t)stride * Bits;
+            for (int i = 0; i < count; ++i, bit += bitStep)
+                out[i] = (TileId)((readWindow(data + bit / 8) >> (bit % 8)) & (maxTiles - 1));
+        }
+    }
+
+private:
+    // Little-endian three-byte window, assembled bytewise so it works on any host
+    static uint32_t readWindow(const uint8_t* p) {
+        return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+    }
+};
+
+// The whole map as one row-major array of codec words
+template <typename Codec>
+class DenseTileStorage {
+public:
+    using Word = typename Codec::WordType;
+    static constexpr unsigned maxTiles = Codec::maxTiles;
+
+    DenseTileStorage(int width, int height)
+        : w(width), h(height), data(Codec::wordCount((size_t)width * height)) {}
+
+    int width() const { return w; }
+    int height() const { return h; }
+    size_t memoryBytes() const { return data.size() * sizeof(Word); }
+
+    unsigned get(int x, int y) const { return Codec::get(data.data(), (size_t)y * w + x); }
+    void set(int x, int y, unsigned tile) { Codec::set(data.data(), (size_t)y * w + x, tile); }
+
+    // Decodes `count` tiles of row y starting at x0, taking every `stride`th tile
+    void decodeRow(int y, int x0, int count, int stride, TileId* out) const {
+        Codec::decode(data.data(), (size_t)y * w + x0, count, stride, out);
+    }
+
+private:
+    int w, h;
+    std::vector<Word> data;
+};
+
+// Chunk compression: a palette of the chunk's distinct tiles, then a bit stream of runs. Each
+// run is either a palette index repeated, or a copy of the tiles one row up (a fixed-distance
+// LZ match, which catches vertical structure); lengths are Elias-gamma coded, so the long runs
+// typical of maps cost a few bits. Fails (returns false) unless the result is under `limit` bytes.
+bool compressChunk(const TileId* tiles, size_t count, size_t limit, std::vector<uint8_t>& out);
+bool decompressChunk(const uint8_t* data, size_t size, size_t count, TileId* out);
+
+// The map as a grid of MAP_CHUNK_SIZE x MAP_CHUNK_SIZE chunks. A chunk holds a single value
+// until a tile in it is set to something else; only then are its tiles allocated. Memory
+// therefore follows the map's content rather than its bounding box.
+// compress() can then re-encode allocated chunks with compressChunk(), and generate() can make
+// every chunk procedural (computed from a function, never stored). Reads of compressed and
+// procedural chunks go through a small LRU of decoded "hot" chunks, shared by all reading threads.
+template <typename Codec>
+class SparseTileStorage {
+public:
+    using CodecType = Codec;
+    using TileFunc = std::function<TileId(int x, int y)>;
+    using Word = typename Codec::WordType;
+    static constexpr unsigned maxTiles = Codec::maxTiles;
+    static constexpr size_t chunkTiles = (size_t)MAP_CHUNK_SIZE * MAP_CHUNK_SIZE;
+
+    SparseTileStorage(int width, int height, TileId fill = 0)
+        : w(width), h(height),
+          chunksX((width + MAP_CHUNK_SIZE - 1) >> MAP_CHUNK_SHIFT),
+          chunksY((height + MAP_CHUNK_SIZE - 1) >> MAP_CHUNK_SHIFT),
+          chunks((size_t)chunksX * chunksY) {
+        for (Chunk& c : chunks)
+            c.uniform = fill;
+    }
+
+    int width() const { return w; }
+    int height() const { return h; }
+    int chunkColumns() const { return chunksX; }
+    int chunkRows() const { return chunksY; }
+
+    // Heap memory owned by the storage; chunks read from a mapped file are not counted
+    size_t memoryBytes() const {
+        size_t bytes = chunks.size() * sizeof(Chunk) + allocatedChunks() * chunkBytes();
+        for (const Chunk& c : chunks)
+            if (c.ownedPacked)
+                bytes += c.packedBytes;
+        std::lock_guard<std::mutex> lock(hot->mutex);
+        return bytes + hot->entries.size() * chunkBytes();
+    }
+
+    size_t allocatedChunks() const {
+        return (size_t)std::count_if(chunks.begin(), chunks.end(), [](const Chunk& c) { return c.owned != nullptr; });
+    }
+
+    size_t mappedChunks() const {
+        return (size_t)std::count_if(chunks.begin(), chunks.end(), [](const Chunk& c) {
+            return (c.words && !c.owned) || (c.packed && !c.ownedPacked);
+        });
+    }
+
+    size_t compressedChunks() const {
+        return (size_t)std::count_if(chunks.begin(), chunks.end(), [](const Chunk& c) { return c.packed != nullptr; });
+    }
+
+    size_t proceduralChunks() const {
+        return (size_t)std::count_if(chunks.begin(), chunks.end(), [](const Chunk& c) { return c.procedural; });
+    }
+
+    // Returns true and the value if every tile of chunk (cx, cy) is the same
+    bool uniformChunk(int cx, int cy, TileId& value) const {
+        const Chunk& c = chunk(cx, cy);
+        value = c.uniform;
+        return !c.words && !c.packed && !c.procedural;
+    }
+
+    // Copies the codec words of a non-uniform chunk (Codec::wordCount(chunkTiles) of them)
+    void copyChunkWords(int cx, int cy, Word* out) const {
+        size_t index = (size_t)cy * chunksX + cx;
+        std::shared_ptr<Word[]> hold;
+        memcpy(out, readableWords(index, hold), chunkBytes());
+    }
+
+    // Points a chunk at words owned by someone else, such as a mapped file, without copying.
+    // A null `words` makes the chunk uniform. The memory must outlive the storage.
+    void attachChunk(int cx, int cy, Word* words, TileId uniform) {
+        Chunk& c = chunk(cx, cy);
+        hot->erase((size_t)cy * chunksX + cx);
+        c.ownedPacked.reset();
+        c.packed = nullptr;
+        c.packedBytes = 0;
+        c.procedural = false;
+        c.owned.reset();
+        c.words = words;
+        c.uniform = uniform;
+    }
+
+    // Same for compressChunk() output: the chunk is decompressed through the hot cache when read
+    void attachPackedChunk(int cx, int cy, const uint8_t* packed, uint32_t bytes) {
+        attachChunk(cx, cy, nullptr, 0);
+        Chunk& c = chunk(cx, cy);
+        c.packed = packed;
+        c.packedBytes = bytes;
+    }
+
+    unsigned get(int x, int y) const {
+        size_t index = (size_t)(y >> MAP_CHUNK_SHIFT) * chunksX + (x >> MAP_CHUNK_SHIFT);
+        std::shared_ptr<Word[]> hold;
+        const Word* words = readableWords(index, hold);
+        return words ? Codec::get(words, local(x, y)) : chunks[index].uniform;
+    }
+
+    void set(int x, int y, unsigned tile) {
+        size_t index = (size_t)(y >> MAP_CHUNK_SHIFT) * chunksX + (x >> MAP_CHUNK_SHIFT);
+        Chunk& c = chunks[index];
+        if (c.packed || c.procedural) {
+            // Edited chunks are stored in plain form, until compress() or settleChunk()
+            std::shared_ptr<Word[]> hold;
+            c.owned.reset(new Word[Codec::wordCount(chunkTiles)]);
+            memcpy(c.owned.get(), readableWords(index, hold), chunkBytes());
+            c.words = c.owned.get();
+            c.ownedPacked.reset();
+            c.packed = nullptr;
+            c.packedBytes = 0;
+            c.procedural = false;
+            hot->erase(index);
+        }
+        if (!c.words) {
+            if (tile == c.uniform)
+                return;
+            // First differing tile: expand the chunk to its full form
+            c.owned.reset(new Word[Codec::wordCount(chunkTiles)]());
+            c.words = c.owned.get();
+            for (size_t i = 0; i < chunkTiles; ++i)
+                Codec::set(c.words, i, c.uniform);
+        }
+        Codec::set(c.words, local(x, y), tile);
+    }
+
+    // Collapses allocated chunks whose tiles all ended up equal back to a single value
+    void compact() {
+        for (Chunk& c : chunks)
+            collapse(c);
+    }
+
+    // Drops all tiles and takes them from `tiles` instead, computed only when read. Edited
+    // chunks are stored as usual. `tiles` is called from any thread that reads the storage.
+    void generate(TileFunc tiles) {
+        hot->clear();
+        generator = std::move(tiles);
+        for (Chunk& c : chunks) {
+            c.owned.reset();
+            c.words = nullptr;
+            c.ownedPacked.reset();
+            c.packed = nullptr;
+            c.packedBytes = 0;
+            c.procedural = true;
+        }
+    }
+
+    // Replaces allocated chunks by their compressed form wherever that is smaller
+    void compress() {
+        std::vector<TileId> tiles(chunkTiles);
+        std::vector<uint8_t> packed;
+        for (Chunk& c : chunks)
+            pack(c, tiles, packed);
+    }
+
+    // compact() and compress() for one chunk, such as one that is no longer being edited
+    void settleChunk(int cx, int cy) {
+        std::vector<TileId> tiles(chunkTiles);
+        std::vector<uint8_t> packed;
+        Chunk& c = chunk(cx, cy);
+        if (!collapse(c))
+            pack(c, tiles, packed);
+    }
+
+    // Decodes `count` tiles of row y starting at x0, taking every `stride`th tile.
+    // Works a chunk at a time: uniform chunks become a plain fill.
+    void decodeRow(int y, int x0, int count, int stride, TileId* out) const {
+        int cy = y >> MAP_CHUNK_SHIFT;
+        size_t rowStart = (size_t)(y & (MAP_CHUNK_SIZE - 1)) * MAP_CHUNK_SIZE;
+        int x = x0;
+        while (count > 0) {
+            int cx = x >> MAP_CHUNK_SHIFT;
+            int inChunk = std::min(count, ((cx + 1) * MAP_CHUNK_SIZE - x + stride - 1) / stride);
+            size_t index = (size_t)cy * chunksX + cx;
+            std::shared_ptr<Word[]> hold;
+            if (chunks[index].procedural && stride > 1) {
+                // Sampled rows touch few tiles of each chunk: compute just those
+                for (int i = 0; i < inChunk; ++i)
+                    out[i] = generator(x + i * stride, y);
+            } else if (const Word* words = readableWords(index, hold))
+                Codec::decode(words, rowStart + (x & (MAP_CHUNK_SIZE - 1)), inChunk, stride, out);
+            else
+                std::fill(out, out + inChunk, chunks[index].uniform);
+            out += inChunk;
+            count -= inChunk;
+            x += inChunk * stride;
+        }
+    }
+
+    // Hot-chunk cache lookups, for statistics
+    void hotStats(unsigned long long& hits, unsigned long long& misses) const {
+        std::lock_guard<std::mutex> lock(hot->mutex);
+        hits = hot->hits;
+        misses = hot->misses;
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<Word[]> owned;     // Tiles allocated by the storage itself
+        Word* words = nullptr;             // Tiles to use: `owned`, memory attached by attachChunk, or null
+        std::unique_ptr<uint8_t[]> ownedPacked; // compressChunk() output allocated by the storage itself
+        const uint8_t* packed = nullptr;   // Compressed tiles to use, when `words` is null: `ownedPacked`, attached memory, or null
+        uint32_t packedBytes = 0;
+        bool procedural = false;           // Tiles come from `generator`
+        TileId uniform = 0;
+    };
+
+    // Decompressed copies of recently read compressed chunks. Readers hold a reference while
+    // they decode, so an entry evicted by another thread stays alive until they are done.
+    struct HotCache {
+        struct Entry {
+            std::shared_ptr<Word[]> words;
+            std::list<size_t>::iterator lru;
+        };
+        std::mutex mutex;
+        std::unordered_map<size_t, Entry> entries;
+        std::list<size_t> lru; // Most recently used first
+        unsigned long long hits = 0, misses = 0;
+
+        void clear() {
+            std::lock_guard<std::mutex> lock(mutex);
+            entries.clear();
+            lru.clear();
+        }
+
+        void erase(size_t index) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(index);
+            if (it != entries.end()) {
+                lru.erase(it->second.lru);
+                entries.erase(it);
+            }
+        }
+    };
+
+    static size_t chunkBytes() { return Codec::wordCount(chunkTiles) * sizeof(Word); }
+
+    // Words to read chunk `index` from, or null if it is uniform. Compressed and procedural
+    // chunks come from the hot cache, and `hold` keeps the returned words alive.
+    const Word* readableWords(size_t index, std::shared_ptr<Word[]>& hold) const {
+        const Chunk& c = chunks[index];
+        if (c.words || (!c.packed && !c.procedural))
+            return c.words;
+        {
+            std::lock_guard<std::mutex> lock(hot->mutex);
+            auto it = hot->entries.find(index);
+            if (it != hot->entries.end()) {
+                hot->hits++;
+                hot->lru.splice(hot->lru.begin(), hot->lru, it->second.lru);
+                hold = it->second.words;
+                return hold.get();
+            }
+            hot->misses++;
+        }
+
+        // Decode without the lock; two threads missing on the same chunk both do the work
+        TileId tiles[chunkTiles];
+        if (c.packed) {
+            // A damaged payload (only possible in a file) reads as tile 0 rather than failing the frame
+            if (!decompressChunk(c.packed, c.packedBytes, chunkTiles, tiles) ||
+                std::any_of(tiles, tiles + chunkTiles, [](TileId t) { return t >= maxTiles; }))
+                std::fill(tiles, tiles + chunkTiles, 0);
+        } else {
+            int x0 = (int)(index % chunksX) * MAP_CHUNK_SIZE, y0 = (int)(index / chunksX) * MAP_CHUNK_SIZE;
+            for (size_t i = 0; i < chunkTiles; ++i) {
+                int x = x0 + (int)(i % MAP_CHUNK_SIZE), y = y0 + (int)(i / MAP_CHUNK_SIZE);
+                tiles[i] = x < w && y < h ? generator(x, y) : 0;
+            }
+        }
+        hold.reset(new Word[Codec::wordCount(chunkTiles)]());
+        for (size_t i = 0; i < chunkTiles; ++i)
+            Codec::set(hold.get(), i, tiles[i]);
+
+        std::lock_guard<std::mutex> lock(hot->mutex);
+        if (!hot->entries.count(index)) {
+            hot->lru.push_front(index);
+            hot->entries[index] = typename HotCache::Entry{hold, hot->lru.begin()};
+            while (hot->entries.size() > HOT_CHUNK_BUDGET) {
+                hot->entries.erase(hot->lru.back());
+                hot->lru.pop_back();
+            }
+        }
+        return hold.get();
+    }
+
+    bool collapse(Chunk& c) {
+        if (!c.owned)
+            return false;
+        unsigned first = Codec::get(c.words, 0);
+        size_t i = 1;
+        while (i < chunkTiles && Codec::get(c.words, i) == first)
+            ++i;
+        if (i < chunkTiles)
+            return false;
+        c.owned.reset();
+        c.words = nullptr;
+        c.uniform = (TileId)first;
+        return true;
+    }
+
+    void pack(Chunk& c, std::vector<TileId>& tiles, std::vector<uint8_t>& packed) {
+        if (!c.owned)
+            return;
+        Codec::decode(c.words, 0, (int)chunkTiles, 1, tiles.data());
+        if (!compressChunk(tiles.data(), chunkTiles, chunkBytes(), packed))
+            return;
+        c.ownedPacked.reset(new uint8_t[packed.size()]);
+        memcpy(c.ownedPacked.get(), packed.data(), packed.size());
+        c.packed = c.ownedPacked.get();
+        c.packedBytes = (uint32_t)packed.size();
+        c.owned.reset();
+        c.words = nullptr;
+    }
+
+    Chunk& chunk(int cx, int cy) { return chunks[(size_t)cy * chunksX + cx]; }
+    const Chunk& chunk(int cx, int cy) const { return chunks[(size_t)cy * chunksX + cx]; }
+    static size_t local(int x, int y) {
+        return (size_t)(y & (MAP_CHUNK_SIZE - 1)) * MAP_CHUNK_SIZE + (x & (MAP_CHUNK_SIZE - 1));
+    }
+
+    int w, h;
+    int chunksX, chunksY;
+    std::vector<Chunk> chunks;
+    std::unique_ptr<HotCache> hot{new HotCache};
+    TileFunc generator;
+};
+
+// Storage used by the viewer: one byte per tile, for tilesets of up to 256 tiles (the bundled
+// one has 77, more than six bits can number). A fully populated 10000x10000 map takes about
+// 100 MB instead of 400 MB as int, and empty regions take next to nothing. TileCodec<uint8_t, 6>
+// would take 75 MB for up to 64 tiles; DenseTileStorage is a single flat array. Wider tile IDs
+// (TileCodec<uint16_t>) would also need LodPyramid, which keeps one byte per block, widened.
+using TileStorage = SparseTileStorage<TileCodec<uint8_t>>;
+static_assert(TILES_PER_ROW * TILES_PER_ROW <= (int)TileStorage::maxTiles, "tileset does not fit the tile storage");
+
+// Counter-based map generator: every tile is a hash of (seed, x, y), so any tile or chunk can be
+// computed on its own, on any thread and in any order, and a seed always gives the same map
+// (unlike rand(), whose sequence differs between C libraries)
+struct MapGenerator {
+    uint64_t seed;
+    unsigned tileCount;
+
+    TileId tile(int x, int y) const {
+        // SplitMix64 finalizer over the tile's position
+        uint64_t z = seed + ((uint64_t)(uint32_t)y << 32 | (uint32_t)x) * 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        z ^= z >> 31;
+        return (TileId)(((z >> 32) * tileCount) >> 32); // Uniform over [0, tileCount)
+    }
+};
+
+// How the visible tiles are submitted to OpenGL
+enum class RenderMode {
+    Immediate,   // One glBegin/glEnd pair per tile
+    VertexArray, // Whole visible range in one client-side array, one glDrawArrays
+    DisplayList  // Cached per-chunk display lists, one glCallList per visible chunk
+};
+
+// How the map is drawn once tiles are smaller than MIN_VISIBLE_PIXELS
+enum class FarZoomMode {
+    Skip,    // Draw every Nth tile at N times the size
+    Pyramid, // Draw colour textures built from the LOD pyramid
+    ColorMap // Write one texel per visible tile (or pyramid block) into a streaming texture
+};
+
+// Which colour stands for a tile wherever it is drawn as a single texel
+enum class TileColor {
+    Average, // Mean of all its pixels
+    Dominant // Mean of its most common colour (to 5 bits per channel), so a few outliers do not tint it
+};
+
+inline const char* renderModeName(RenderMode mode) {
+    switch (mode) {
+    case RenderMode::Immediate:   return "immediate";
+    case RenderMode::VertexArray: return "vertex arrays";
+    case RenderMode::DisplayList: return "display lists";
+    }
+    return "";
+}
+
+inline const char* farZoomModeName(FarZoomMode mode) {
+    switch (mode) {
+    case FarZoomMode::Skip:     return "skip";
+    case FarZoomMode::Pyramid:  return "pyramid";
+    case FarZoomMode::ColorMap: return "color map";
+    }
+    return "";
+}
+
+struct Rgba {
+    unsigned char r, g, b, a;
+};
+
+// Interleaved vertex used by the batched renderer (GL_T2F_V2F layout)
+struct TileVertex {
+    GLfloat u, v;
+    GLfloat x, y;
+};
+
+// Quad emission kernel: turns a row of `count` decoded tile indices into four vertices each.
+// Tile i covers (x0 + i * size, y0) to (x0 + (i + 1) * size, y0 + size) and `uvTable` holds
+// (u0, v0, u1, v1) for every tile index.
+using QuadKernel = void (*)(TileVertex* out, const TileId* tiles, int count,
+                            float x0, float y0, float size, const float* uvTable);
+
+enum class KernelChoice { Auto, Scalar, Sse2, Avx2 };
+
+void emitQuadsScalar(TileVertex* out, const TileId* tiles, int count,
+                     float x0, float y0, float size, const float* uvTable);
+#ifdef TILES_HAVE_SSE2
+void emitQuadsSse2(TileVertex* out, const TileId* tiles, int count,
+                   float x0, float y0, float size, const float* uvTable);
+#endif
+#ifdef TILES_HAVE_AVX2
+void emitQuadsAvx2(TileVertex* out, const TileId* tiles, int count,
+                   float x0, float y0, float size, const float* uvTable);
+#endif
+QuadKernel selectQuadKernel(KernelChoice choice);
+const char* quadKernelName(QuadKernel kernel);
+int runMicrobenchmarks();
+int runMapRoundTripTest();
+
+// Identifies a cached map region: a square of cells, each covering `step` x `step` tiles.
+// Display-list chunks hold CHUNK_SIZE tiles sampled every `step` tiles; pyramid pages hold
+// PYRAMID_PAGE_SIZE texels of pyramid level log2(step).
+struct ChunkKey {
+    int cx, cy, step;
+    bool operator==(const ChunkKey& o) const { return cx == o.cx && cy == o.cy && step == o.step; }
+};
+
+struct ChunkKeyHash {
+    size_t operator()(const ChunkKey& k) const {
+        size_t h = (size_t)k.cx * 73856093u;
+        h ^= (size_t)k.cy * 19349663u;
+        h ^= (size_t)k.step * 83492791u;
+        return h;
+    }
+};
+
+// LRU cache of GL objects (display lists, textures) built from static map regions.
+// Objects are never deleted directly: evicted or invalidated ones are queued and released by
+// releasePending(), which must be called while the GL context is current.
+class ChunkCache {
+public:
+    using ReleaseFunc = std::function<void(GLuint)>;
+
+    ChunkCache(int cellsPerSide, size_t budget, ReleaseFunc release)
+        : cellsPerSide(cellsPerSide), budget(budget), release(release) {}
+
+    GLuint find(const ChunkKey& key);
+    void insert(const ChunkKey& key, GLuint object);
+    void invalidateTile(int x, int y);
+    void invalidateIf(const std::function<bool(const ChunkKey&, GLuint)>& stale);
+    void setBudget(size_t newBudget);
+    void releasePending();
+    void clear(); // Release every object (on the next releasePending)
+    void reset(); // Forget all objects without deleting them (the context that owned them is gone)
+
+    size_t size() const { return entries.size(); }
+
+private:
+    struct Entry {
+        ChunkKey key;
+        GLuint object;
+    };
+
+    void evictToBudget();
+
+    int cellsPerSide;
+    size_t budget;
+    ReleaseFunc release;
+    std::list<Entry> entries; // Most recently used first
+    std::unordered_map<ChunkKey, std::list<Entry>::iterator, ChunkKeyHash> index;
+    std::vector<GLuint> pendingDelete;
+};
+
+class ThreadPool;
+
+// Mip-style pyramid of the map. Level k stores one representative tile per 2^k x 2^k block:
+// the most common of its four children, with ties going to the top-left child.
+// Level 0 is the map itself and is not stored.
+class LodPyramid {
+public:
+    // With a pool, each level is computed in parallel row bands; getTile must then be thread-safe
+    template <typename GetTile> void build(int width, int height, GetTile getTile, ThreadPool* pool = nullptr);
+    template <typename GetTile> void update(int x, int y, GetTile getTile);
+
+    // Uses levels stored elsewhere (a mapped file) instead of building them: level 1 starts
+    // at `data`, and every level takes levelBytes() of its size
+    void attach(int width, int height, uint8_t* data);
+    static size_t levelBytes(int width, int height) { return ((size_t)width * height + 7) & ~(size_t)7; }
+
+    int levelCount() const { return (int)levels.size() + 1; }
+    int levelWidth(int level) const { return levels[level - 1].width; }
+    int levelHeight(int level) const { return levels[level - 1].height; }
+    const uint8_t* levelData(int level) const { return levels[level - 1].tiles; }
+    uint8_t tileAt(int level, int x, int y) const {
+        const Level& l = levels[level - 1];
+        return l.tiles[(size_t)y * l.width + x];
+    }
+
+private:
+    struct Level {
+        int width = 0, height = 0;
+        uint8_t* tiles = nullptr;   // `owned`, or attached memory
+        std::vector<uint8_t> owned;
+    };
+
+    static uint8_t representative(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+        if (a == b || a == c || a == d) return a;
+        if (b == c || b == d) return b;
+        if (c == d) return c;
+        return a;
+    }
+
+    template <typename GetTile> uint8_t computeBlock(int level, int x, int y, GetTile& getTile) const;
+
+    int baseWidth = 0, baseHeight = 0;
+    std::vector<Level> levels; // levels[k - 1] is level k
+};
+static_assert(TileStorage::maxTiles <= 256, "the LOD pyramid stores tile IDs in one byte");
+
+// On-disk map (.fltmap). Host byte order (little-endian on every supported platform), every
+// section 8-byte aligned:
+//   MapFileHeader
+//   MapChunkEntry[chunksX * chunksY]   row-major chunk directory
+//   chunk payloads                     for non-uniform chunks: TileCodec words, chunkBytes each, or
+//                                      compressChunk() output where that is smaller (version 2)
+//   pyramid levels 1..pyramidLevels    one byte per block, LodPyramid::levelBytes each
+const char MAP_FILE_MAGIC[8] = {'F', 'L', 'T', 'I', 'L', 'E', 'S', '\0'};
+const uint32_t MAP_FILE_VERSION = 2; // Version 1 files (plain payloads only) are still read
+
+struct MapFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t tileBits;         // TileCodec bits of the payloads
+    uint32_t width, height;    // In tiles
+    uint32_t chunkSize;        // Tiles per chunk side
+    uint32_t chunksX, chunksY;
+    uint32_t pyramidLevels;
+    uint64_t chunkBytes;       // Size of one chunk payload
+    uint64_t directoryOffset;
+    uint64_t pyramidOffset;
+};
+
+// Size of a chunk payload: the codec words of one chunk, padded to 8 bytes
+inline uint64_t mapChunkBytes() {
+    return (TileStorage::CodecType::wordCount(TileStorage::chunkTiles) * sizeof(TileStorage::Word) + 7) & ~(uint64_t)7;
+}
+
+struct MapChunkEntry {
+    uint64_t offset;      // Payload position in the file, or 0 for a uniform chunk
+    uint32_t uniform;     // Value of every tile of a uniform chunk
+    uint32_t packedBytes; // Size of a compressed payload, or 0 for TileCodec words (always 0 in version 1)
+};
+
+// A whole file mapped into memory. The mapping is private: writes copy the touched pages and
+// never reach the file. (Without mmap, on Windows, the file is read into memory instead.)
+class MappedFile {
+public:
+    ~MappedFile();
+    static std::unique_ptr<MappedFile> open(const char* path);
+
+    uint8_t* at(uint64_t offset) const { return static_cast<uint8_t*>(base) + offset; }
+    size_t fileSize() const { return size; }
+
+protected:
+    MappedFile() = default;
+    bool map(const char* path); // Reports failures on stderr
+
+private:
+    void* base = nullptr;
+    size_t size = 0;
+};
+
+// A map file mapped into memory. Storage and pyramid point straight into it, so it must
+// outlive them.
+class MapFile : public MappedFile {
+public:
+    static std::unique_ptr<MapFile> open(const char* path);
+
+    const MapFileHeader& header() const { return *reinterpret_cast<const MapFileHeader*>(at(0)); }
+
+private:
+    MapFile() = default;
+};
+
+bool writeMapFile(const char* path, const TileStorage& map, const LodPyramid& pyramid);
+bool loadMapFile(MapFile& file, TileStorage& map, LodPyramid& pyramid);
+
+// A map opened or generated away from the GUI thread, ready for TilemapWindow::installMap()
+struct PreparedMap {
+    std::unique_ptr<MapFile> file; // Backs tiles and pyramid when the map was opened; outlives both
+    TileStorage tiles{0, 0};
+    LodPyramid pyramid;
+};
+
+bool prepareMapFile(const char* path, PreparedMap& out);
+void prepareGeneratedMap(uint64_t seed, ThreadPool* pool, PreparedMap& out);
+
+// RGBA8 pixels of an image file; `pixels` is null if it could not be read
+struct DecodedImage {
+    int width = 0, height = 0;
+    const unsigned char* pixels = nullptr; // width * height * 4 bytes
+    std::shared_ptr<const void> owner;     // Keeps `pixels` alive: stb_image's buffer or a mapped cache
+};
+
+// Decoded image cache (<image>.rgba): ImageCacheHeader, then width * height RGBA8 texels.
+// Only used while the image's size, modification time and FNV-1a hash all still match.
+const char IMAGE_CACHE_MAGIC[8] = {'F', 'L', 'T', 'R', 'G', 'B', 'A', '\0'};
+const uint32_t IMAGE_CACHE_VERSION = 1;
+
+struct ImageCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t reserved;
+    uint64_t sourceSize;
+    int64_t sourceMtime; // Seconds since the epoch
+    uint64_t sourceHash; // FNV-1a of the image file
+};
+
+// Loads an image as RGBA8. With `useCache`, a decode also writes the cache next to the image,
+// and later loads map the cache instead of decoding.
+DecodedImage loadImage(const char* filename, bool useCache);
+
+// Where progress messages go: stdout, or stderr when stdout carries JSON
+static FILE* logStream = stdout;
+
+// Taken during static initialisation: as close to process start as portable code gets
+static const std::chrono::steady_clock::time_point processStart = std::chrono::steady_clock::now();
+
+// Time-to-first-frame phases in milliseconds since process start. Each phase is recorded the
+// first time any thread reaches it; finish() reports them all once the first frame is shown.
+class StartupTimeline {
+public:
+    void mark(const char* phase);
+    void setJsonPath(const char* path) { jsonPath = path; }
+    void finish();
+
+private:
+    struct Phase {
+        const char* name;
+        double ms;
+    };
+
+    std::mutex mutex;
+    std::vector<Phase> phases;
+    const char* jsonPath = nullptr; // "-" for stdout
+    bool finished = false;
+};
+
+static StartupTimeline startupTimeline;
+
+// Scoped CPU timing zones, exported as Chrome trace JSON (about:tracing, Perfetto). Only built
+// with -DTILES_TRACE; otherwise TRACE_ZONE and TRACE_THREAD compile to nothing.
+#ifdef TILES_TRACE
+
+// One thread's zones in a fixed ring, oldest overwritten first. Only the owning thread writes;
+// writeTrace() reads while it runs and skips whatever was overwritten during the copy.
+struct TraceBuffer {
+    struct Event {
+        std::atomic<const char*> name{nullptr};
+        std::atomic<int64_t> startNs{0}, durationNs{0};
+    };
+    static_assert((TRACE_EVENTS_PER_THREAD & (TRACE_EVENTS_PER_THREAD - 1)) == 0, "trace rings must be a power of two");
+
+    int tid = 0;
+    std::atomic<const char*> threadName{nullptr};
+    std::atomic<uint64_t> written{0};
+    std::unique_ptr<Event[]> events{new Event[TRACE_EVENTS_PER_THREAD]};
+};
+
+TraceBuffer& traceBuffer(); // The calling thread's, registered on first use
+
+inline int64_t traceNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - processStart).count();
+}
+
+class TraceZone {
+public:
+    explicit TraceZone(const char* name) : name(name), start(traceNow()) {}
+    ~TraceZone() {
+        TraceBuffer& buffer = traceBuffer();
+        uint64_t n = buffer.written.load(std::memory_order_relaxed);
+        TraceBuffer::Event& e = buffer.events[n & (TRACE_EVENTS_PER_THREAD - 1)];
+        e.name.store(name, std::memory_order_relaxed);
+        e.startNs.store(start, std::memory_order_relaxed);
+        e.durationNs.store(traceNow() - start, std::memory_order_relaxed);
+        buffer.written.store(n + 1, std::memory_order_release);
+    }
+
+private:
+    const char* name;
+    int64_t start;
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#define TRACE_THREAD(name) traceBuffer().threadName.store(name, std::memory_order_relaxed)
+
+#else
+
+#define TRACE_ZONE(name) ((void)0)
+#define TRACE_THREAD(name) ((void)0)
+
+#endif
+
+// Writes every thread's recorded zones; reports an error when tracing is not built in
+bool writeTrace(const char* path);
+
+// Fixed set of worker threads fed from a shared queue.
+// parallelFor() blocks until every index is processed; the calling thread takes part, so a pool
+// without workers simply runs the loop inline.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threadCount);
+    ~ThreadPool();
+
+    void submit(std::function<void()> task);
+    void parallelFor(int count, const std::function<void(int)>& body);
+    int size() const { return (int)workers.size(); }
+
+private:
+    void workerLoop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+};
+
+// Decodes map chunks on a background thread into a bounded LRU of resident chunks, so drawing
+// never waits on storage (a mapped file faults its pages in on first touch).
+// request() runs once per frame on the GL thread and replaces the loader's queue; decoded chunks
+// become resident in installCompleted(), which the loader schedules through Fl::awake. The
+// resident set changes only in those calls, so render threads may call find() while drawing.
+class ChunkStreamer {
+public:
+    using DecodeFunc = std::function<void(int cx, int cy, TileId* out)>; // Rows MAP_CHUNK_SIZE apart
+
+    struct Stats {
+        unsigned long long lookups = 0; // Visible chunks asked for
+        unsigned long long hits = 0;    // ... that were already resident
+        unsigned long long stalls = 0;  // Frames drawn with at least one visible chunk missing
+    };
+
+    ChunkStreamer(size_t budget, DecodeFunc decode, Fl_Awake_Handler arrived, void* userdata);
+    ~ChunkStreamer();
+
+    static uint64_t key(int cx, int cy) { return (uint64_t)(uint32_t)cy << 32 | (uint32_t)cx; }
+
+    const TileId* find(int cx, int cy) const;
+    // Visible chunks first, then prefetch candidates, each in the order they should load
+    void request(const std::vector<uint64_t>& visible, const std::vector<uint64_t>& prefetch);
+    bool installCompleted(); // True if any chunk became resident
+    void patch(int x, int y, TileId tile); // Mirror an edit; chunks decoded before it are dropped
+    void clear();                          // The map was replaced
+
+    const Stats& stats() const { return counters; }
+    size_t residentCount() const { return resident.size(); }
+
+private:
+    struct Resident {
+        std::unique_ptr<TileId[]> tiles;
+        std::list<uint64_t>::iterator lru;
+    };
+    struct Loaded {
+        uint64_t key;
+        unsigned version;
+        std::unique_ptr<TileId[]> tiles;
+    };
+    static const uint64_t NO_CHUNK = ~(uint64_t)0;
+
+    void loaderLoop();
+
+    size_t budget;
+    DecodeFunc decode;
+    Fl_Awake_Handler arrived;
+    void* userdata;
+    Stats counters;
+
+    // Main thread only
+    std::unordered_map<uint64_t, Resident> resident;
+    std::list<uint64_t> lru; // Most recently used first
+
+    // Shared with the loader, guarded by `mutex`
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<uint64_t> queue;
+    std::vector<Loaded> completed;
+    uint64_t inFlight = NO_CHUNK;
+    unsigned version = 0;      // Bumped by edits and clear(); stale results are dropped
+    bool awakePending = false;
+    bool stopping = false;
+    std::thread loader;        // Last, so it starts after everything above is constructed
+};
+
+// Summary of recent frame times (draw plus buffer swap), in milliseconds
+struct FrameStats {
+    size_t frames = 0; // How many of the recent frames the figures cover
+    float meanMs = 0.0f, p50Ms = 0.0f, p95Ms = 0.0f, p99Ms = 0.0f, maxMs = 0.0f;
+};
+
+// GL work submitted by one draw(), not counting the HUD itself
+struct RenderStats {
+    size_t drawCalls = 0;     // glBegin/glEnd pairs, glDrawArrays and glCallList calls
+    size_t vertices = 0;
+    size_t textureBinds = 0;
+    size_t tilesDrawn = 0;    // Map tiles in the drawn view rectangles, whatever step samples them
+    size_t tilesCulled = 0;   // The rest of the map
+    int lodStep = 1;          // Tile sampling step of the last rectangle drawn
+    size_t bytesUploaded = 0; // Texel data sent with glTexImage2D and glTexSubImage2D
+};
+
+// The part of the map inside a screen rectangle
+struct ViewRange {
+    float left, top, right, bottom;     // World coordinates
+    float pixelsPerTile;
+    int tileX0, tileY0, tileX1, tileY1; // Tiles [x0, x1) x [y0, y1), clamped to the map
+    int step;                           // Every step-th tile is drawn, covering step x step tiles
+};
+
+// Fixed-size ring of the most recent frame times. One thread pushes; any thread may read,
+// without locks or allocation. A reader racing the writer may see a mix of old and new
+// samples, which is fine for statistics.
+class FrameTimeRing {
+public:
+    static_assert((FRAME_HISTORY & (FRAME_HISTORY - 1)) == 0, "frame history must be a power of two");
+
+    void push(float ms) {
+        uint64_t n = count.load(std::memory_order_relaxed);
+        samples[n & (FRAME_HISTORY - 1)].store(ms, std::memory_order_relaxed);
+        count.store(n + 1, std::memory_order_release);
+    }
+
+    // Copies up to `max` of the most recent samples, oldest first; returns how many
+    size_t recent(float* out, size_t max) const {
+        uint64_t n = count.load(std::memory_order_acquire);
+        size_t k = (size_t)std::min<uint64_t>(std::min(n, (uint64_t)FRAME_HISTORY), max);
+        for (size_t i = 0; i < k; ++i)
+            out[i] = samples[(n - k + i) & (FRAME_HISTORY - 1)].load(std::memory_order_relaxed);
+        return k;
+    }
+
+    FrameStats summarize() const {
+        float sorted[FRAME_HISTORY];
+        FrameStats stats;
+        stats.frames = recent(sorted, FRAME_HISTORY);
+        if (stats.frames == 0)
+            return stats;
+        std::sort(sorted, sorted + stats.frames);
+        float total = 0.0f;
+        for (size_t i = 0; i < stats.frames; ++i)
+            total += sorted[i];
+        auto at = [&](float p) { return sorted[std::min(stats.frames - 1, (size_t)(p * stats.frames))]; };
+        stats.meanMs = total / stats.frames;
+        stats.p50Ms = at(0.50f);
+        stats.p95Ms = at(0.95f);
+        stats.p99Ms = at(0.99f);
+        stats.maxMs = sorted[stats.frames - 1];
+        return stats;
+    }
+
+private:
+    std::atomic<float> samples[FRAME_HISTORY] = {};
+    std::atomic<uint64_t> count{0};
+};
+
+class TilemapWindow : public Fl_Gl_Window {
+public:
+    TilemapWindow(int x, int y, int w, int h);
+    ~TilemapWindow();
+
+    void draw() override;
+    void flush() override;
+    int handle(int event) override;
+
+    void loadTilesetAsync(const std::vector<std::string>& filenames, bool useCache = true);
+    void setAtlasPageLimit(int pixels) { atlasPageLimit = pixels; }
+    void watchTileset();
+    void drawTile(int tileIndex, int x, int y, int size);
+    void drawTilesBatched(int tileX0, int tileY0, int tileX1, int tileY1, int step);
+    void drawTilesChunked(int tileX0, int tileY0, int tileX1, int tileY1, int step);
+    void updateHoveredTile(int mouseX, int mouseY);
+    ViewRange visibleRange(int screenX0, int screenY0, int screenX1, int screenY1) const;
+    void readRow(int y, int x0, int count, int step, TileId* out) const;
+    void installMap(PreparedMap&& map);
+    void setTile(int x, int y, int tileIndex);
+    int mapWidth() const { return tileMap.width(); }
+    int mapHeight() const { return tileMap.height(); }
+    void setChunkBudget(size_t budget) { chunkCache.setBudget(budget); }
+    void setBenchmarkMode(bool on);
+    void setFarZoomMode(FarZoomMode mode) { farZoomMode = mode; frameValid = false; redraw(); }
+    void setTileColor(TileColor source);
+    void setScrollBlit(bool on) { scrollBlit = on; frameValid = false; redraw(); }
+    void setWorkerThreads(int count);
+    ThreadPool* workers() const { return workerPool.get(); }
+    void setQuadKernel(KernelChoice choice) { quadKernel = selectQuadKernel(choice); }
+    void setStreaming(bool on);
+    void setCamera(float x, float y, float scale);
+    bool mapShown() const { return firstFrameShown; }
+    FrameStats frameStats() const { return frameTimes.summarize(); }
+    const RenderStats& renderStats() const { return lastFrameWork; }
+    void setHud(bool on) { hudVisible = on; redraw(); }
+    void setTracePath(const char* path) { tracePath = path; }
+
+    // Shared view state
+    float offsetX = 0.0f, offsetY = 0.0f;
+    float zoom = 1.0f;
+    TilemapScrollView* parentView = nullptr;
+    RenderMode renderMode = RenderMode::VertexArray;
+
+private:
+    friend int runMicrobenchmarks(); // Times fillTileRows() with its own uvTable
+
+    static void benchmarkIdle(void* userdata);
+    static void reportStats(void* userdata);
+    static void chunksArrived(void* userdata);
+    static void tilesetArrived(void* userdata);
+    static void tilesetChanged(int fd, void* userdata);
+    static void pollTileset(void* userdata);
+    static void startReloads(void* userdata);
+
+    size_t fillTileVertices(int tileX0, int tileY0, int tileX1, int tileY1, int step);
+    void sortQuadsByPage(size_t quadCount);
+    bool tilesetReady();
+    void indexTiles();
+    void uploadTileset();
+    void fillAtlasCell(int tile);
+    void refreshAtlasRegion(size_t page, int x0, int y0, int x1, int y1, bool upload);
+    void applyTilesetReloads();
+    void rebuildTileset();
+    void fillTileRows(TileVertex* out, uint16_t* pages, int tileX0, int tileX1, int rowY0, int rowY1, int step) const;
+    TileId placeholderTile(int cx, int cy) const;
+    void updateStreaming();
+    GLuint compileChunk(const ChunkKey& key);
+    void mapReplaced();
+    void drawMap(int screenX0, int screenY0, int screenX1, int screenY1);
+    bool canReuseFrame(int& shiftX, int& shiftY) const;
+    void drawPreviousFrame(int shiftX, int shiftY);
+    void drawExposed(int screenX0, int screenY0, int screenX1, int screenY1);
+    void captureFrame();
+    GLuint buildPyramidPage(const ChunkKey& key);
+    int pyramidLevelFor(float pixelsPerTile) const;
+    void drawHud();
+    void bindTexture(GLuint texture) { glBindTexture(GL_TEXTURE_2D, texture); ++frameWork.textureBinds; }
+    void countDraw(size_t vertices) { ++frameWork.drawCalls; frameWork.vertices += vertices; }
+    void updateTitle();
+    void drawColorMap(float viewLeft, float viewTop, float viewRight, float viewBottom, float pixelsPerTile);
+    const std::vector<Rgba>& tileColors() const { return tileColor == TileColor::Dominant ? tileDominant : tileAverage; }
+    void drawPyramid(float viewLeft, float viewTop, float viewRight, float viewBottom, float pixelsPerTile);
+
+    // Tileset images, decoded on background threads. Tile IDs number the tiles of each image
+    // row by row, images in the order given.
+    std::atomic<int> pendingDecodes{0}; // Declared first: the decodes below use it until they are joined
+    std::vector<std::future<DecodedImage>> tilesetSources; // Decodes still running
+    std::vector<DecodedImage> tilesetImages; // Kept after the first upload so a new context needs no decode
+    std::vector<std::string> tilesetPaths;
+    bool tilesetCache = true;
+    int tileCount = 0;
+    bool firstFrameShown = false;
+    std::vector<Rgba> tileAverage, tileDominant; // Colours of each tile, see TileColor
+    TileColor tileColor = TileColor::Average;
+    struct TileOrigin {
+        int image, x, y;
+    };
+    std::vector<TileOrigin> tileOrigins; // Where each tile is in the tileset images
+
+    // Atlas pages: tiles are copied into gutter-padded cells of square power-of-two pages, as
+    // few as GL_MAX_TEXTURE_SIZE allows, with a mip chain computed on the CPU (GL 1.1 cannot
+    // generate one). Tiles are drawn page by page so each page is bound once per frame.
+    struct AtlasPage {
+        int size;                              // Texels per side of level 0
+        std::vector<std::vector<Rgba>> levels; // Level k is (size >> k)^2 texels, down to 1x1
+    };
+    int atlasPageLimit = 0;            // Page size cap below GL_MAX_TEXTURE_SIZE; 0 for none
+    int atlasCellsPerRow = 0;
+    std::vector<AtlasPage> atlasPages; // CPU copies, so a changed tile can be filtered down again
+    std::vector<GLuint> pageTextures;  // Empty until uploaded to the current context
+    std::vector<uint16_t> tilePage;    // Atlas page of each tile
+    std::vector<float> uvTable;        // (u0, v0, u1, v1) of each tile within its page
+    QuadKernel quadKernel = selectQuadKernel(KernelChoice::Auto);
+    std::unique_ptr<MapFile> mapFile; // Backs tileMap and pyramid when a map was opened; outlives both
+    TileStorage tileMap{MAP_WIDTH, MAP_HEIGHT};
+    std::vector<TileVertex> vertexBuffer; // Reused between frames to avoid reallocating
+    std::vector<uint16_t> quadPages;      // Page of each quad in vertexBuffer, with more than one page
+    std::vector<TileVertex> sortedVertices;
+    std::vector<size_t> pageFirst;        // Vertices of page p: [pageFirst[p], pageFirst[p + 1])
+    std::unique_ptr<ThreadPool> workerPool; // Fills vertex bands in parallel; null when single-threaded
+    // Each chunk is one display list per atlas page, allocated as a consecutive range
+    ChunkCache chunkCache{CHUNK_SIZE, DEFAULT_CHUNK_BUDGET, [this](GLuint list) {
+                              glDeleteLists(list, (GLsizei)atlasPages.size());
+                              chunkVertices.erase(list);
+                          }};
+    std::unordered_map<GLuint, std::vector<size_t>> chunkVertices; // Per page, for the statistics
+
+    FarZoomMode farZoomMode = FarZoomMode::Pyramid;
+    LodPyramid pyramid;
+    ChunkCache pyramidPages{PYRAMID_PAGE_SIZE, PYRAMID_PAGE_BUDGET, [this](GLuint tex) {
+                                glDeleteTextures(1, &tex);
+                                pyramidPageTiles.erase(tex);
+                            }};
+    std::vector<Rgba> pageBuffer; // Staging memory for pyramid page uploads
+    // Tile IDs used by each cached pyramid page, by texture, so a tileset change only rebuilds
+    // the pages that show a changed tile
+    using TileMask = std::bitset<TileStorage::maxTiles>; // One bit per tile ID
+    std::unordered_map<GLuint, TileMask> pyramidPageTiles;
+
+    // Colour map: the visible blocks of one pyramid level, one texel each, rewritten in a single
+    // texture whenever the blocks in view (or their tiles) change
+    struct ColorMapView {
+        int level, x0, y0, x1, y1;
+        bool operator==(const ColorMapView& o) const {
+            return level == o.level && x0 == o.x0 && y0 == o.y0 && x1 == o.x1 && y1 == o.y1;
+        }
+    };
+    GLuint colorMapTexture = 0;
+    int colorMapTexW = 0, colorMapTexH = 0;
+    bool colorMapValid = false;
+    ColorMapView colorMapView{};
+    std::vector<Rgba> colorMapBuffer;
+
+    // Tileset hot reload: changed images are decoded again in the background, and only the
+    // tiles that differ are uploaded
+    struct PendingReload {
+        int image;
+        std::future<DecodedImage> result;
+        bool superseded = false; // A later reload of the same image was started; this one is dropped
+    };
+    int watchFd = -1;                    // inotify descriptor, where available
+    std::vector<int> watchIds;           // Watch of each tileset image's directory
+    std::vector<int64_t> tilesetMtimes;  // Where inotify is missing: last seen modification times
+    std::vector<bool> reloadRequested;
+    std::vector<PendingReload> reloads;
+
+    // Background chunk decoding for maps on disk; null when the renderer reads storage directly
+    std::mutex storageMutex; // Held by the loader while decoding, and by anything that modifies tileMap
+    std::unique_ptr<ChunkStreamer> streamer;
+    int editChunkX = -1, editChunkY = -1; // Storage chunk of the last edit; compressed once edits move on
+
+    // Scroll blit: the previous frame's map, kept in a texture and reused while panning
+    bool scrollBlit = false;
+    bool frameValid = false;
+    GLuint frameTexture = 0;
+    int frameTexW = 0, frameTexH = 0;
+    int frameW = 0, frameH = 0;
+    float frameOffsetX = 0.0f, frameOffsetY = 0.0f, frameZoom = 0.0f;
+
+    int lastMouseX = 0, lastMouseY = 0;
+    bool dragging = false;
+    float panVelocityX = 0.0f, panVelocityY = 0.0f; // Screen pixels per second, smoothed over drag events
+    std::chrono::steady_clock::time_point lastDragTime;
+    int hoveredX = -1, hoveredY = -1;
+
+    // Redraws are normally driven by damage (input, edits); benchmark mode redraws continuously
+    bool benchmarkMode = false;
+
+    // Frame statistics: per-frame times in the ring, rates summed up every STATS_INTERVAL seconds
+    FrameTimeRing frameTimes;
+    RenderStats frameWork;             // Counted by the draw() in progress
+    RenderStats lastFrameWork;         // Of the last complete draw()
+    long long framesRendered = 0;      // Since startup
+    double idleSeconds = 0.0;          // Since startup, time not spent drawing or swapping
+    int framesSinceReport = 0;
+    double busySinceReport = 0.0;
+    double reportedFps = 0.0, reportedIdle = 100.0; // Over the last complete interval
+    std::chrono::steady_clock::time_point lastReportTime;
+
+    // On-screen statistics, drawn over the map in window coordinates
+    bool hudVisible = true;
+    float hudSamples[FRAME_HISTORY];
+    float hudVertices[FRAME_HISTORY * 4]; // Two (x, y) points per graph bar
+    char windowTitle[160] = "";           // Last title set, so the label only changes with the modes
+    const char* tracePath = "tiles-trace.json"; // Written by the T key
+};
+
+class TilemapScrollView : public Fl_Group {
+public:
+    TilemapWindow* canvas;
+    Fl_Scrollbar* hscroll;
+    Fl_Scrollbar* vscroll;
+
+    TilemapScrollView(int X, int Y, int W, int H);
+    void updateScrollbars();
+    void resize(int X, int Y, int W, int H) override;
+};
+
+// =============== Chunk Compression ==================
+
+namespace {
+
+// Bits are written least significant first, one value at a time
+struct BitWriter {
+    std::vector<uint8_t>& out;
+    uint64_t pending = 0;
+    int pendingBits = 0;
+
+    void put(uint32_t value, int bits) {
+        pending |= (uint64_t)value << pendingBits;
+        pendingBits += bits;
+        while (pendingBits >= 8) {
+            out.push_back((uint8_t)pending);
+            pending >>= 8;
+            pendingBits -= 8;
+        }
+    }
+    void putGamma(uint32_t n) { // n >= 1: floor(log2 n) zero bits, then n from its top bit down
+        int top = 0;
+        while ((n >> top) > 1)
+            ++top;
+        put(0, top);
+        for (int b = top; b >= 0; --b)
+            put((n >> b) & 1, 1);
+    }
+    void finish() {
+        if (pendingBits > 0)
+            out.push_back((uint8_t)pending);
+        pending = 0;
+        pendingBits = 0;
+    }
+};
+
+// Reads past the end of the input give zero bits and set `overrun`
+struct BitReader {
+    const uint8_t* in;
+    size_t size;
+    size_t bit = 0;
+    bool overrun = false;
+
+    uint32_t get(int bits) {
+        uint32_t value = 0;
+        for (int b = 0; b < bits; ++b, ++bit) {
+            if ((bit >> 3) >= size) {
+                overrun = true;
+                return 0;
+            }
+            value |= (uint32_t)((in[bit >> 3] >> (bit & 7)) & 1) << b;
+        }
+        return value;
+    }
+    // Returns 0, which no length encodes, when the input ends or the value needs over 32 bits
+    uint32_t getGamma() {
+        int top = 0;
+        while (get(1) == 0) {
+            if (overrun || ++top == 32)
+                return 0;
+        }
+        uint32_t n = 1;
+        for (int b = 0; b < top; ++b)
+            n = (n << 1) | get(1);
+        return overrun ? 0 : n;
+    }
+};
+
+int bitsFor(size_t values) {
+    int bits = 0;
+    while (((size_t)1 << bits) < values)
+        ++bits;
+    return bits;
+}
+
+} // namespace
+
+// Layout: palette size - 1 (one byte), the palette (little-endian 16-bit tiles), then the runs:
+// a flag bit (0 = repeat, 1 = copy from the row above), the palette index for repeats, and the
+// run length
+bool compressChunk(const TileId* tiles, size_t count, size_t limit, std::vector<uint8_t>& out) {
+    std::vector<TileId> palette;
+    std::unordered_map<TileId, uint32_t> paletteIndex;
+    for (size_t i = 0; i < count; ++i) {
+        if (paletteIndex.emplace(tiles[i], (uint32_t)palette.size()).second)
+            palette.push_back(tiles[i]);
+        if (palette.size() > 256)
+            return false;
+    }
+
+    out.clear();
+    out.push_back((uint8_t)(palette.size() - 1));
+    for (TileId t : palette) {
+        out.push_back((uint8_t)t);
+        out.push_back((uint8_t)(t >> 8));
+    }
+
+    const size_t rowLength = MAP_CHUNK_SIZE;
+    int indexBits = bitsFor(palette.size());
+    BitWriter writer{out};
+    for (size_t i = 0; i < count && out.size() < limit;) {
+        size_t repeat = 1, copy = 0;
+        while (i + repeat < count && tiles[i + repeat] == tiles[i])
+            ++repeat;
+        if (i >= rowLength)
+            while (i + copy < count && tiles[i + copy] == tiles[i + copy - rowLength])
+                ++copy;
+        if (copy >= repeat) {
+            writer.put(1, 1);
+            writer.putGamma((uint32_t)copy);
+            i += copy;
+        } else {
+            writer.put(0, 1);
+            writer.put(paletteIndex[tiles[i]], indexBits);
+            writer.putGamma((uint32_t)repeat);
+            i += repeat;
+        }
+    }
+    writer.finish();
+    return out.size() < limit;
+}
+
+// Returns false if `data` (`size` bytes) is not a valid encoding of `count` tiles
+bool decompressChunk(const uint8_t* data, size_t size, size_t count, TileId* out) {
+    if (size < 1)
+        return false;
+    size_t paletteSize = (size_t)data[0] + 1;
+    if (size < 1 + paletteSize * 2)
+        return false;
+    TileId palette[256];
+    for (size_t p = 0; p < paletteSize; ++p)
+        palette[p] = (TileId)(data[1 + p * 2] | data[2 + p * 2] << 8);
+
+    const size_t rowLength = MAP_CHUNK_SIZE;
+    int indexBits = bitsFor(paletteSize);
+    BitReader reader{data + 1 + paletteSize * 2, size - 1 - paletteSize * 2};
+    for (size_t i = 0; i < count;) {
+        bool copy = reader.get(1) != 0;
+        uint32_t index = copy ? 0 : reader.get(indexBits);
+        uint32_t run = reader.getGamma();
+        if (run == 0 || index >= paletteSize || (copy && i < rowLength))
+            return false;
+        size_t end = std::min(count, i + run);
+        for (; i < end; ++i)
+            out[i] = copy ? out[i - rowLength] : palette[index];
+    }
+    return true;
+}
+
+// =============== ChunkCache Implementation ==================
+
+GLuint ChunkCache::find(const ChunkKey& key) {
+    auto it = index.find(key);
+    if (it == index.end())
+        return 0;
+    entries.splice(entries.begin(), entries, it->second); // Mark as most recently used
+    return it->second->object;
+}
+
+void ChunkCache::insert(const ChunkKey& key, GLuint object) {
+    entries.push_front({key, object});
+    index[key] = entries.begin();
+    evictToBudget();
+}
+
+void ChunkCache::invalidateTile(int x, int y) {
+    // Edits are rare and the cache is small, so a linear scan is cheaper than
+    // keeping a second index by tile position
+    for (auto it = entries.begin(); it != entries.end();) {
+        int span = cellsPerSide * it->key.step;
+        if (x / span == it->key.cx && y / span == it->key.cy) {
+            pendingDelete.push_back(it->object);
+            index.erase(it->key);
+            it = entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void ChunkCache::invalidateIf(const std::function<bool(const ChunkKey&, GLuint)>& stale) {
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (stale(it->key, it->object)) {
+            pendingDelete.push_back(it->object);
+            index.erase(it->key);
+            it = entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void ChunkCache::setBudget(size_t newBudget) {
+    budget = std::max<size_t>(1, newBudget);
+    evictToBudget();
+}
+
+void ChunkCache::evictToBudget() {
+    while (entries.size() > budget) {
+        pendingDelete.push_back(entries.back().object);
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+void ChunkCache::releasePending() {
+    for (GLuint object : pendingDelete)
+        release(object);
+    pendingDelete.clear();
+}
+
+void ChunkCache::clear() {
+    for (const Entry& e : entries)
+        pendingDelete.push_back(e.object);
+    entries.clear();
+    index.clear();
+}
+
+void ChunkCache::reset() {
+    entries.clear();
+    index.clear();
+    pendingDelete.clear();
+}
+
+// =============== Quad Emission Kernels ==================
+
+void emitQuadsScalar(TileVertex* out, const TileId* tiles, int count,
+                     float x0, float y0, float size, const float* uvTable) {
+    float y1 = y0 + size;
+    for (int i = 0; i < count; ++i) {
+        const float* uv = uvTable + tiles[i] * 4;
+        float x1 = x0 + size;
+        out[0] = { uv[0], uv[1], x0, y0 };
+        out[1] = { uv[2], uv[1], x1, y0 };
+        out[2] = { uv[2], uv[3], x1, y1 };
+        out[3] = { uv[0], uv[3], x0, y1 };
+        out += 4;
+        x0 = x1;
+    }
+}
+
+#ifdef TILES_HAVE_SSE2
+// A TileVertex is exactly one SSE register: (u, v, x, y). Each of the four corners is a
+// single shuffle of the tile's (u0, v0, u1, v1) and the quad's (x0, y0, x1, y1).
+static inline void emitQuadSse2(TileVertex* out, __m128 uv, __m128 pos) {
+    float* dst = &out->u;
+    _mm_storeu_ps(dst,      _mm_shuffle_ps(uv, pos, _MM_SHUFFLE(1, 0, 1, 0))); // u0 v0 x0 y0
+    _mm_storeu_ps(dst + 4,  _mm_shuffle_ps(uv, pos, _MM_SHUFFLE(1, 2, 1, 2))); // u1 v0 x1 y0
+    _mm_storeu_ps(dst + 8,  _mm_shuffle_ps(uv, pos, _MM_SHUFFLE(3, 2, 3, 2))); // u1 v1 x1 y1
+    _mm_storeu_ps(dst + 12, _mm_shuffle_ps(uv, pos, _MM_SHUFFLE(3, 0, 3, 0))); // u0 v1 x0 y1
+}
+
+void emitQuadsSse2(TileVertex* out, const TileId* tiles, int count,
+                   float x0, float y0, float size, const float* uvTable) {
+    __m128 pos = _mm_setr_ps(x0, y0, x0 + size, y0 + size);
+    const __m128 advance = _mm_setr_ps(size, 0.0f, size, 0.0f);
+    int i = 0;
+    // Eight tiles per iteration keeps the table loads ahead of the stores
+    for (; i + 8 <= count; i += 8) {
+        for (int k = 0; k < 8; ++k) {
+            emitQuadSse2(out, _mm_loadu_ps(uvTable + tiles[i + k] * 4), pos);
+            pos = _mm_add_ps(pos, advance);
+            out += 4;
+        }
+    }
+    for (; i < count; ++i) {
+        emitQuadSse2(out, _mm_loadu_ps(uvTable + tiles[i] * 4), pos);
+        pos = _mm_add_ps(pos, advance);
+        out += 4;
+    }
+}
+#endif
+
+#ifdef TILES_HAVE_AVX2
+// Two tiles per register: the low lane holds tile A, the high lane tile B. The in-lane
+// shuffles build matching corners of both quads, then lane permutes put A's four
+// vertices before B's.
+__attribute__((target("avx2")))
+void emitQuadsAvx2(TileVertex* out, const TileId* tiles, int count,
+                   float x0, float y0, float size, const float* uvTable) {
+    __m256 pos = _mm256_setr_ps(x0, y0, x0 + size, y0 + size,
+                                x0 + size, y0, x0 + 2 * size, y0 + size);
+    const __m256 advance = _mm256_setr_ps(2 * size, 0.0f, 2 * size, 0.0f, 2 * size, 0.0f, 2 * size, 0.0f);
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m256 uv = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(uvTable + tiles[i] * 4)),
+                                         _mm_loadu_ps(uvTable + tiles[i + 1] * 4), 1);
+        __m256 c0 = _mm256_shuffle_ps(uv, pos, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 c1 = _mm256_shuffle_ps(uv, pos, _MM_SHUFFLE(1, 2, 1, 2));
+        __m256 c2 = _mm256_shuffle_ps(uv, pos, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 c3 = _mm256_shuffle_ps(uv, pos, _MM_SHUFFLE(3, 0, 3, 0));
+        float* dst = &out->u;
+        _mm256_storeu_ps(dst,      _mm256_permute2f128_ps(c0, c1, 0x20));
+        _mm256_storeu_ps(dst + 8,  _mm256_permute2f128_ps(c2, c3, 0x20));
+        _mm256_storeu_ps(dst + 16, _mm256_permute2f128_ps(c0, c1, 0x31));
+        _mm256_storeu_ps(dst + 24, _mm256_permute2f128_ps(c2, c3, 0x31));
+        pos = _mm256_add_ps(pos, advance);
+        out += 8;
+    }
+    if (i < count)
+        emitQuadsScalar(out, tiles + i, count - i, x0 + i * size, y0, size, uvTable);
+}
+#endif
+
+QuadKernel selectQuadKernel(KernelChoice choice) {
+#ifdef TILES_HAVE_AVX2
+    bool avx2 = __builtin_cpu_supports("avx2");
+    if (choice == KernelChoice::Avx2 || (choice == KernelChoice::Auto && avx2))
+        return avx2 ? emitQuadsAvx2 : emitQuadsSse2;
+#endif
+#ifdef TILES_HAVE_SSE2
+    if (choice != KernelChoice::Scalar)
+        return emitQuadsSse2;
+#endif
+    return emitQuadsScalar;
+}
+
+const char* quadKernelName(QuadKernel kernel) {
+#ifdef TILES_HAVE_AVX2
+    if (kernel == emitQuadsAvx2) return "avx2";
+#endif
+#ifdef TILES_HAVE_SSE2
+    if (kernel == emitQuadsSse2) return "sse2";
+#endif
+    return "scalar";
+}
+
+// =============== ThreadPool Implementation ==================
+
+ThreadPool::ThreadPool(int threadCount) {
+    for (int i = 0; i < threadCount; ++i)
+        workers.emplace_back([this] { workerLoop(); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : workers)
+        t.join();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::workerLoop() {
+    TRACE_THREAD("worker");
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty())
+                return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& body) {
+    // Indices are claimed from a shared counter, so fast threads pick up the slack of slow ones.
+    // The state lives on this stack frame, so wait for every runner to leave, not just for
+    // the last index to finish.
+    std::atomic<int> next{0};
+    int helpers = std::min(size(), count - 1);
+    int running = helpers + 1;
+    std::mutex doneMutex;
+    std::condition_variable doneCv;
+
+    auto run = [&] {
+        for (int i = next++; i < count; i = next++)
+            body(i);
+        std::lock_guard<std::mutex> lock(doneMutex);
+        if (--running == 0)
+            doneCv.notify_one();
+    };
+
+    for (int i = 0; i < helpers; ++i)
+        submit(run);
+    run();
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneCv.wait(lock, [&] { return running == 0; });
+}
+
+// =============== ChunkStreamer Implementation ==================
+
+ChunkStreamer::ChunkStreamer(size_t budget, DecodeFunc decode, Fl_Awake_Handler arrived, void* userdata)
+    : budget(std::max<size_t>(1, budget)), decode(std::move(decode)), arrived(arrived), userdata(userdata),
+      loader(&ChunkStreamer::loaderLoop, this) {}
+
+ChunkStreamer::~ChunkStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    loader.join();
+}
+
+const TileId* ChunkStreamer::find(int cx, int cy) const {
+    auto it = resident.find(key(cx, cy));
+    return it == resident.end() ? nullptr : it->second.tiles.get();
+}
+
+void ChunkStreamer::request(const std::vector<uint64_t>& visible, const std::vector<uint64_t>& prefetch) {
+    bool missing = false;
+    for (uint64_t k : visible) {
+        counters.lookups++;
+        auto it = resident.find(k);
+        if (it == resident.end()) {
+            missing = true;
+            continue;
+        }
+        counters.hits++;
+        lru.splice(lru.begin(), lru, it->second.lru);
+    }
+    if (missing)
+        counters.stalls++;
+    // Prefetched chunks that are already here should not be the next to go either
+    for (uint64_t k : prefetch) {
+        auto it = resident.find(k);
+        if (it != resident.end())
+            lru.splice(lru.begin(), lru, it->second.lru);
+    }
+
+    {
+        // Whatever is still queued from the last frame is either requested again or no
+        // longer worth loading
+        std::lock_guard<std::mutex> lock(mutex);
+        auto wanted = [&](uint64_t k) {
+            if (k == inFlight || resident.count(k))
+                return false;
+            for (const Loaded& l : completed)
+                if (l.key == k)
+                    return false;
+            return true;
+        };
+        queue.clear();
+        for (uint64_t k : visible)
+            if (wanted(k))
+                queue.push_back(k);
+        for (uint64_t k : prefetch)
+            if (queue.size() < budget && wanted(k))
+                queue.push_back(k);
+    }
+    wake.notify_one();
+}
+
+bool ChunkStreamer::installCompleted() {
+    std::vector<Loaded> batch;
+    unsigned current;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch.swap(completed);
+        awakePending = false;
+        current = version;
+    }
+
+    bool installed = false;
+    for (Loaded& l : batch) {
+        // Decoded before an edit or a map change: the next frame asks for it again
+        if (l.version != current || resident.count(l.key))
+            continue;
+        lru.push_front(l.key);
+        resident[l.key] = Resident{std::move(l.tiles), lru.begin()};
+        installed = true;
+    }
+    while (resident.size() > budget) {
+        resident.erase(lru.back());
+        lru.pop_back();
+    }
+    return installed;
+}
+
+void ChunkStreamer::patch(int x, int y, TileId tile) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        version++;
+    }
+    auto it = resident.find(key(x >> MAP_CHUNK_SHIFT, y >> MAP_CHUNK_SHIFT));
+    if (it != resident.end())
+        it->second.tiles[(size_t)(y & (MAP_CHUNK_SIZE - 1)) * MAP_CHUNK_SIZE + (x & (MAP_CHUNK_SIZE - 1))] = tile;
+}
+
+void ChunkStreamer::clear() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.clear();
+        completed.clear();
+        version++;
+    }
+    resident.clear();
+    lru.clear();
+}
+
+void ChunkStreamer::loaderLoop() {
+    TRACE_THREAD("chunk loader");
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping)
+            return;
+        uint64_t k = queue.front();
+        queue.pop_front();
+        inFlight = k;
+        unsigned stamp = version;
+        lock.unlock();
+
+        std::unique_ptr<TileId[]> tiles(new TileId[(size_t)MAP_CHUNK_SIZE * MAP_CHUNK_SIZE]());
+        {
+            TRACE_ZONE("decode chunk");
+            decode((int)(uint32_t)k, (int)(k >> 32), tiles.get());
+        }
+
+        lock.lock();
+        inFlight = NO_CHUNK;
+        completed.push_back(Loaded{k, stamp, std::move(tiles)});
+        // One wakeup per batch: the main thread installs everything that finished meanwhile
+        if (!awakePending) {
+            awakePending = true;
+            Fl::awake(arrived, userdata);
+        }
+    }
+}
+
+// =============== LodPyramid Implementation ==================
+
+template <typename GetTile>
+uint8_t LodPyramid::computeBlock(int level, int x, int y, GetTile& getTile) const {
+    // Children on the right/bottom edge may fall outside an odd-sized level; reuse the
+    // top-left child for them so edge blocks are not biased towards a made-up tile
+    int childW = level == 1 ? baseWidth : levels[level - 2].width;
+    int childH = level == 1 ? baseHeight : levels[level - 2].height;
+    int x0 = 2 * x, y0 = 2 * y;
+    int x1 = std::min(x0 + 1, childW - 1), y1 = std::min(y0 + 1, childH - 1);
+    auto child = [&](int cx, int cy) -> uint8_t {
+        return level == 1 ? (uint8_t)getTile(cx, cy) : tileAt(level - 1, cx, cy);
+    };
+    return representative(child(x0, y0), child(x1, y0), child(x0, y1), child(x1, y1));
+}
+
+template <typename GetTile>
+void LodPyramid::build(int width, int height, GetTile getTile, ThreadPool* pool) {
+    baseWidth = width;
+    baseHeight = height;
+    levels.clear();
+    int w = width, h = height;
+    while (w > 1 || h > 1) {
+        TRACE_ZONE("pyramid level");
+        Level level;
+        level.width = w = (w + 1) / 2;
+        level.height = h = (h + 1) / 2;
+        level.owned.resize((size_t)w * h);
+        level.tiles = level.owned.data();
+        levels.push_back(std::move(level));
+
+        // Blocks only read the level below, so rows of one level are independent
+        int k = (int)levels.size();
+        uint8_t* tiles = levels.back().tiles;
+        auto fillRows = [&, w](int rowBegin, int rowEnd) {
+            uint8_t* out = tiles + (size_t)rowBegin * w;
+            for (int y = rowBegin; y < rowEnd; ++y)
+                for (int x = 0; x < w; ++x)
+                    *out++ = computeBlock(k, x, y, getTile);
+        };
+        if (pool && pool->size() > 0) {
+            int bands = std::min(h, (pool->size() + 1) * BANDS_PER_THREAD);
+            pool->parallelFor(bands, [&, h](int band) { fillRows(h * band / bands, h * (band + 1) / bands); });
+        } else {
+            fillRows(0, h);
+        }
+    }
+}
+
+template <typename GetTile>
+void LodPyramid::update(int x, int y, GetTile getTile) {
+    // Recompute the one block per level that contains the edited tile, stopping early
+    // once a level comes out unchanged
+    for (int k = 1; k <= (int)levels.size(); ++k) {
+        x /= 2;
+        y /= 2;
+        uint8_t value = computeBlock(k, x, y, getTile);
+        uint8_t& stored = levels[k - 1].tiles[(size_t)y * levels[k - 1].width + x];
+        // Attached levels live in a private mapping, so this write only copies one page
+        if (stored == value)
+            break;
+        stored = value;
+    }
+}
+
+void LodPyramid::attach(int width, int height, uint8_t* data) {
+    baseWidth = width;
+    baseHeight = height;
+    levels.clear();
+    int w = width, h = height;
+    while (w > 1 || h > 1) {
+        Level level;
+        level.width = w = (w + 1) / 2;
+        level.height = h = (h + 1) / 2;
+        level.tiles = data;
+        data += levelBytes(w, h);
+        levels.push_back(std::move(level));
+    }
+}
+
+// =============== MappedFile Implementation ==================
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+    free(base);
+#else
+    if (base)
+        munmap(base, size);
+#endif
+}
+
+std::unique_ptr<MappedFile> MappedFile::open(const char* path) {
+    std::unique_ptr<MappedFile> file(new MappedFile);
+    return file->map(path) ? std::move(file) : nullptr;
+}
+
+bool MappedFile::map(const char* path) {
+#ifdef _WIN32
+    // No mmap here: read the whole file instead (not zero-copy, but the same layout)
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    size = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+    base = malloc(size);
+    bool ok = base && fread(base, 1, size, f) == size;
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        return false;
+    }
+#else
+    int fd = ::open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    // Private and writable: edits copy single pages in memory and never reach the file
+    void* mapped = st.st_size ? mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "Failed to map %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    base = mapped;
+    size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+// =============== Image Loading ==================
+
+namespace {
+
+uint64_t fnv1a64(const uint8_t* data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+void writeImageCache(const std::string& path, ImageCacheHeader header, const DecodedImage& image) {
+    header.width = (uint32_t)image.width;
+    header.height = (uint32_t)image.height;
+    size_t bytes = (size_t)image.width * image.height * 4;
+    std::string temporary = path + ".tmp";
+    FILE* f = fopen(temporary.c_str(), "wb");
+    bool ok = f && fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(image.pixels, 1, bytes, f) == bytes;
+    if (f)
+        ok = fclose(f) == 0 && ok;
+    // Renamed into place, so another viewer never maps a half-written cache
+#ifdef _WIN32
+    if (ok)
+        remove(path.c_str());
+#endif
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        fprintf(stderr, "Failed to write image cache: %s\n", path.c_str());
+        remove(temporary.c_str());
+    }
+}
+
+} // namespace
+
+DecodedImage loadImage(const char* filename, bool useCache) {
+    TRACE_ZONE("load image");
+    // The file is read either way: its bytes key the cache, and are what gets decoded on a miss
+    std::vector<uint8_t> source;
+    struct stat st;
+    FILE* f = fopen(filename, "rb");
+    if (f && stat(filename, &st) == 0) {
+        source.resize((size_t)st.st_size);
+        if (fread(source.data(), 1, source.size(), f) != source.size())
+            source.clear();
+    }
+    if (f)
+        fclose(f);
+    if (source.empty()) {
+        fprintf(stderr, "Failed to load image: %s\n", filename);
+        return DecodedImage();
+    }
+
+    ImageCacheHeader key{};
+    memcpy(key.magic, IMAGE_CACHE_MAGIC, sizeof(key.magic));
+    key.version = IMAGE_CACHE_VERSION;
+    key.sourceSize = source.size();
+    key.sourceMtime = (int64_t)st.st_mtime;
+    key.sourceHash = fnv1a64(source.data(), source.size());
+    std::string cachePath = std::string(filename) + ".rgba";
+
+    DecodedImage image;
+    struct stat cacheStat;
+    if (useCache && stat(cachePath.c_str(), &cacheStat) == 0) { // No cache yet is not an error
+        std::shared_ptr<MappedFile> cache = MappedFile::open(cachePath.c_str());
+        const ImageCacheHeader* h = cache && cache->fileSize() >= sizeof(ImageCacheHeader)
+                                        ? reinterpret_cast<const ImageCacheHeader*>(cache->at(0))
+                                        : nullptr;
+        if (h && memcmp(h->magic, key.magic, sizeof(key.magic)) == 0 && h->version == key.version &&
+            h->sourceSize == key.sourceSize && h->sourceMtime == key.sourceMtime && h->sourceHash == key.sourceHash &&
+            cache->fileSize() == sizeof(ImageCacheHeader) + (size_t)h->width * h->height * 4) {
+            // Straight from the page cache to glTexImage2D; nothing is decoded or copied
+            image.width = (int)h->width;
+            image.height = (int)h->height;
+            image.pixels = cache->at(sizeof(ImageCacheHeader));
+            image.owner = cache;
+            fprintf(logStream, "Image %s: %dx%d, mapped from %s\n", filename, image.width, image.height, cachePath.c_str());
+            return image;
+        }
+    }
+
+    int n;
+    unsigned char* data;
+    {
+        TRACE_ZONE("decode");
+        data = stbi_load_from_memory(source.data(), (int)source.size(), &image.width, &image.height, &n, 4);
+    }
+    if (!data) {
+        fprintf(stderr, "Failed to load image: %s\n", filename);
+        return DecodedImage();
+    }
+    image.pixels = data;
+    image.owner = std::shared_ptr<unsigned char>(data, stbi_image_free);
+    fprintf(logStream, "Image %s: %dx%d, decoded\n", filename, image.width, image.height);
+    if (useCache) {
+        TRACE_ZONE("write image cache");
+        writeImageCache(cachePath, key, image);
+    }
+    return image;
+}
+
+// =============== MapFile Implementation ==================
+
+std::unique_ptr<MapFile> MapFile::open(const char* path) {
+    std::unique_ptr<MapFile> file(new MapFile);
+    if (!file->map(path))
+        return nullptr;
+
+    if (file->fileSize() < sizeof(MapFileHeader) || memcmp(file->header().magic, MAP_FILE_MAGIC, sizeof(MAP_FILE_MAGIC)) != 0 ||
+        file->header().version < 1 || file->header().version > MAP_FILE_VERSION) {
+        fprintf(stderr, "Not a tile map (or an unsupported version): %s\n", path);
+        return nullptr;
+    }
+    const MapFileHeader& h = file->header();
+    size_t chunkCount = (size_t)h.chunksX * h.chunksY;
+    if (h.tileBits != TileStorage::CodecType::bits || h.chunkSize != MAP_CHUNK_SIZE) {
+        fprintf(stderr, "Map uses %u-bit tiles in %u-tile chunks, this build expects %d-bit tiles in %d-tile chunks: %s\n",
+                h.tileBits, h.chunkSize, TileStorage::CodecType::bits, MAP_CHUNK_SIZE, path);
+        return nullptr;
+    }
+    // Offsets come from the file: compare them without sums that could wrap around
+    size_t size = file->fileSize();
+    if (h.directoryOffset > size || chunkCount > (size - h.directoryOffset) / sizeof(MapChunkEntry) ||
+        h.pyramidOffset > size) {
+        fprintf(stderr, "Truncated map: %s\n", path);
+        return nullptr;
+    }
+    return file;
+}
+
+bool writeMapFile(const char* path, const TileStorage& map, const LodPyramid& pyramid) {
+    using Word = TileStorage::Word;
+    MapFileHeader header{};
+    memcpy(header.magic, MAP_FILE_MAGIC, sizeof(header.magic));
+    header.version = MAP_FILE_VERSION;
+    header.tileBits = TileStorage::CodecType::bits;
+    header.width = map.width();
+    header.height = map.height();
+    header.chunkSize = MAP_CHUNK_SIZE;
+    header.chunksX = map.chunkColumns();
+    header.chunksY = map.chunkRows();
+    header.pyramidLevels = pyramid.levelCount() - 1;
+    header.chunkBytes = mapChunkBytes();
+    header.directoryOffset = sizeof(MapFileHeader);
+
+    // Stored chunks are compressed wherever that is smaller. Payloads are compressed once to
+    // lay out the directory and again as they are written, so no more than one is in memory.
+    std::vector<uint8_t> padded(header.chunkBytes, 0);
+    std::vector<TileId> tiles(TileStorage::chunkTiles);
+    std::vector<uint8_t> packed;
+    auto packChunk = [&](int cx, int cy) {
+        map.copyChunkWords(cx, cy, reinterpret_cast<Word*>(padded.data()));
+        TileStorage::CodecType::decode(reinterpret_cast<Word*>(padded.data()), 0, (int)tiles.size(), 1, tiles.data());
+        return compressChunk(tiles.data(), tiles.size(), header.chunkBytes, packed);
+    };
+
+    // Lay out the directory first so every offset is known before anything is written
+    size_t chunkCount = (size_t)header.chunksX * header.chunksY;
+    std::vector<MapChunkEntry> directory(chunkCount);
+    uint64_t offset = header.directoryOffset + chunkCount * sizeof(MapChunkEntry);
+    for (int cy = 0; cy < map.chunkRows(); ++cy) {
+        for (int cx = 0; cx < map.chunkColumns(); ++cx) {
+            MapChunkEntry& e = directory[(size_t)cy * header.chunksX + cx];
+            TileId uniform;
+            if (map.uniformChunk(cx, cy, uniform)) {
+                e.uniform = uniform;
+                continue;
+            }
+            e.offset = offset;
+            if (packChunk(cx, cy)) {
+                e.packedBytes = (uint32_t)packed.size();
+                offset += (packed.size() + 7) & ~(size_t)7;
+            } else {
+                offset += header.chunkBytes;
+            }
+        }
+    }
+    header.pyramidOffset = offset;
+
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to create map: %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(directory.data(), sizeof(MapChunkEntry), chunkCount, f) == chunkCount;
+    for (size_t i = 0; ok && i < chunkCount; ++i) {
+        if (!directory[i].offset)
+            continue;
+        if (packChunk((int)(i % header.chunksX), (int)(i / header.chunksX))) {
+            packed.resize((packed.size() + 7) & ~(size_t)7, 0);
+            ok = fwrite(packed.data(), 1, packed.size(), f) == packed.size();
+        } else {
+            ok = fwrite(padded.data(), 1, padded.size(), f) == padded.size();
+        }
+    }
+    for (int level = 1; ok && level < pyramid.levelCount(); ++level) {
+        size_t bytes = (size_t)pyramid.levelWidth(level) * pyramid.levelHeight(level);
+        size_t padding = LodPyramid::levelBytes(pyramid.levelWidth(level), pyramid.levelHeight(level)) - bytes;
+        static const uint8_t zeros[8] = {};
+        ok = fwrite(pyramid.levelData(level), 1, bytes, f) == bytes && fwrite(zeros, 1, padding, f) == padding;
+    }
+    ok = fclose(f) == 0 && ok;
+    if (!ok)
+        fprintf(stderr, "Failed to write map: %s\n", path);
+    return ok;
+}
+
+bool loadMapFile(MapFile& file, TileStorage& map, LodPyramid& pyramid) {
+    const MapFileHeader& h = file.header();
+    // The directory must cover exactly the chunks of the storage built from width and height
+    if (h.width > INT_MAX || h.height > INT_MAX ||
+        h.chunksX != (h.width + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE ||
+        h.chunksY != (h.height + MAP_CHUNK_SIZE - 1) / MAP_CHUNK_SIZE || h.chunkBytes != mapChunkBytes())
+        return false;
+    size_t size = file.fileSize();
+    map = TileStorage((int)h.width, (int)h.height);
+    const MapChunkEntry* directory = reinterpret_cast<const MapChunkEntry*>(file.at(h.directoryOffset));
+    for (int cy = 0; cy < (int)h.chunksY; ++cy) {
+        for (int cx = 0; cx < (int)h.chunksX; ++cx) {
+            const MapChunkEntry& e = directory[(size_t)cy * h.chunksX + cx];
+            uint64_t payloadBytes = e.packedBytes ? e.packedBytes : h.chunkBytes;
+            if (e.offset && (e.offset > size || payloadBytes > size - e.offset || e.packedBytes >= h.chunkBytes))
+                return false;
+            if (!e.offset && (e.uniform >= TileStorage::maxTiles || e.packedBytes))
+                return false;
+            // Payloads are used in place; nothing is read (or decompressed) until a chunk is drawn
+            if (e.packedBytes)
+                map.attachPackedChunk(cx, cy, file.at(e.offset), e.packedBytes);
+            else
+                map.attachChunk(cx, cy, e.offset ? reinterpret_cast<TileStorage::Word*>(file.at(e.offset)) : nullptr,
+                                (TileId)e.uniform);
+        }
+    }
+
+    size_t pyramidBytes = 0;
+    for (int w = h.width, hh = h.height; w > 1 || hh > 1;) {
+        w = (w + 1) / 2;
+        hh = (hh + 1) / 2;
+        pyramidBytes += LodPyramid::levelBytes(w, hh);
+    }
+    if (pyramidBytes > size - h.pyramidOffset) // open() has checked pyramidOffset <= size
+        return false;
+    // Pyramid tiles index the UV and colour tables unchecked, so every one must be a valid ID
+    const uint8_t* levelTiles = file.at(h.pyramidOffset);
+    for (int w = h.width, hh = h.height; w > 1 || hh > 1;) {
+        w = (w + 1) / 2;
+        hh = (hh + 1) / 2;
+        size_t count = (size_t)w * hh;
+        for (size_t i = 0; i < count; ++i)
+            if (levelTiles[i] >= TileStorage::maxTiles)
+                return false;
+        levelTiles += LodPyramid::levelBytes(w, hh);
+    }
+    pyramid.attach((int)h.width, (int)h.height, file.at(h.pyramidOffset));
+    return true;
+}
+
+bool prepareMapFile(const char* path, PreparedMap& out) {
+    out.file = MapFile::open(path);
+    if (!out.file)
+        return false;
+    if (!loadMapFile(*out.file, out.tiles, out.pyramid)) {
+        fprintf(stderr, "Corrupt map: %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+void prepareGeneratedMap(uint64_t seed, ThreadPool* pool, PreparedMap& out) {
+    // Random tile indices, computed only when a chunk is first drawn, read or edited
+    MapGenerator generator{seed, (unsigned)(TILES_PER_ROW * TILES_PER_ROW)};
+    out.file.reset();
+    out.tiles = TileStorage(MAP_WIDTH, MAP_HEIGHT);
+    out.tiles.generate([generator](int x, int y) { return generator.tile(x, y); });
+
+    // The pyramid needs every tile once; take them straight from the generator, in parallel
+    out.pyramid.build(MAP_WIDTH, MAP_HEIGHT, [&generator](int x, int y) { return generator.tile(x, y); }, pool);
+}
+
+// =============== Startup Timeline ==================
+
+void StartupTimeline::mark(const char* phase) {
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - processStart).count();
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const Phase& p : phases)
+        if (!strcmp(p.name, phase))
+            return;
+    phases.push_back({phase, ms});
+}
+
+void StartupTimeline::finish() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (finished)
+        return;
+    finished = true;
+
+    // Phases from different threads are marked in any order; report them as they happened
+    std::sort(phases.begin(), phases.end(), [](const Phase& a, const Phase& b) { return a.ms < b.ms; });
+    fprintf(logStream, "Startup:");
+    for (const Phase& p : phases)
+        fprintf(logStream, " %s %.1f ms%s", p.name, p.ms, &p == &phases.back() ? "\n" : ",");
+
+    if (!jsonPath)
+        return;
+    FILE* f = strcmp(jsonPath, "-") ? fopen(jsonPath, "w") : stdout;
+    if (!f) {
+        fprintf(stderr, "Failed to write startup timings: %s: %s\n", jsonPath, strerror(errno));
+        return;
+    }
+    fprintf(f, "{\"process_start_ms\": 0.0");
+    for (const Phase& p : phases)
+        fprintf(f, ", \"%s_ms\": %.3f", p.name, p.ms);
+    fprintf(f, "}\n");
+    if (f != stdout)
+        fclose(f);
+}
+
+// =============== Tracing ==================
+
+#ifdef TILES_TRACE
+
+static std::mutex traceRegistryMutex;
+static std::vector<std::unique_ptr<TraceBuffer>> traceRegistry; // Never shrinks: threads may exit before a dump
+
+TraceBuffer& traceBuffer() {
+    thread_local TraceBuffer* buffer = [] {
+        std::lock_guard<std::mutex> lock(traceRegistryMutex);
+        traceRegistry.emplace_back(new TraceBuffer);
+        traceRegistry.back()->tid = (int)traceRegistry.size();
+        return traceRegistry.back().get();
+    }();
+    return *buffer;
+}
+
+bool writeTrace(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "error: cannot write '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    struct Copy {
+        const char* name;
+        int64_t startNs, durationNs;
+    };
+    std::vector<Copy> copies;
+    size_t events = 0;
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    bool first = true;
+    std::lock_guard<std::mutex> lock(traceRegistryMutex);
+    for (const std::unique_ptr<TraceBuffer>& buffer : traceRegistry) {
+        if (const char* name = buffer->threadName.load(std::memory_order_relaxed)) {
+            fprintf(f, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                    first ? "" : ",", buffer->tid, name);
+            first = false;
+        }
+        uint64_t end = buffer->written.load(std::memory_order_acquire);
+        uint64_t begin = end > TRACE_EVENTS_PER_THREAD ? end - TRACE_EVENTS_PER_THREAD : 0;
+        copies.clear();
+        for (uint64_t i = begin; i < end; ++i) {
+            const TraceBuffer::Event& e = buffer->events[i & (TRACE_EVENTS_PER_THREAD - 1)];
+            copies.push_back(Copy{e.name.load(std::memory_order_relaxed), e.startNs.load(std::memory_order_relaxed),
+                                  e.durationNs.load(std::memory_order_relaxed)});
+        }
+        // The owner may have lapped the oldest slots meanwhile, including the one it is writing now
+        uint64_t now = buffer->written.load(std::memory_order_acquire) + 1;
+        uint64_t valid = now > TRACE_EVENTS_PER_THREAD ? now - TRACE_EVENTS_PER_THREAD : 0;
+        for (uint64_t i = std::max(begin, valid); i < end; ++i) {
+            const Copy& c = copies[i - begin];
+            fprintf(f, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    first ? "" : ",", c.name, buffer->tid, c.startNs / 1000.0, c.durationNs / 1000.0);
+            first = false;
+            ++events;
+        }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    fprintf(logStream, "Trace: %zu zones written to %s\n", events, path);
+    return true;
+}
+
+#else
+
+bool writeTrace(const char* path) {
+    fprintf(stderr, "error: cannot write '%s': built without -DTILES_TRACE\n", path);
+    return false;
+}
+
+#endif
+
+// =============== TilemapWindow Implementation ==================
+
+TilemapWindow::TilemapWindow(int x, int y, int w, int h)
+    : Fl_Gl_Window(x, y, w, h) {
+    mode(FL_RGB | FL_DOUBLE | FL_DEPTH); // Enable double-buffering for smooth drawing
+
+    // The map starts out uniform until installMap(), and the tileset is blank until loadTilesetAsync()
+
+    // No idle loop: redraw() is only requested when the view or the map changes
+    lastReportTime = std::chrono::steady_clock::now();
+    Fl::add_timeout(STATS_INTERVAL, reportStats, this);
+}
+
+TilemapWindow::~TilemapWindow() {
+    // Join the decodes still running while everything they touch is alive
+    tilesetSources.clear();
+    reloads.clear();
+    Fl::remove_timeout(reportStats, this);
+    Fl::remove_timeout(pollTileset, this);
+    Fl::remove_timeout(startReloads, this);
+#ifdef __linux__
+    if (watchFd >= 0) {
+        Fl::remove_fd(watchFd);
+        close(watchFd);
+    }
+#endif
+    setBenchmarkMode(false);
+    if (!pageTextures.empty())
+        glDeleteTextures((GLsizei)pageTextures.size(), pageTextures.data());
+    if (frameTexture)
+        glDeleteTextures(1, &frameTexture);
+    if (colorMapTexture)
+        glDeleteTextures(1, &colorMapTexture);
+}
+
+void TilemapWindow::installMap(PreparedMap&& map) {
+    {
+        // Drop the old storage before the file that may back it
+        std::lock_guard<std::mutex> lock(storageMutex);
+        tileMap = std::move(map.tiles);
+        pyramid = std::move(map.pyramid);
+        mapFile = std::move(map.file);
+    }
+    mapReplaced();
+}
+
+void TilemapWindow::mapReplaced() {
+    fprintf(logStream, "Map %dx%d: %.1f MB in memory, %zu chunks allocated, %zu compressed, %zu procedural, %zu mapped, %d total\n",
+            tileMap.width(), tileMap.height(), tileMap.memoryBytes() / 1048576.0, tileMap.allocatedChunks(),
+            tileMap.compressedChunks(), tileMap.proceduralChunks(), tileMap.mappedChunks(),
+            tileMap.chunkColumns() * tileMap.chunkRows());
+    chunkCache.clear();
+    pyramidPages.clear();
+    if (streamer)
+        streamer->clear();
+    frameValid = colorMapValid = false;
+    hoveredX = hoveredY = -1;
+    editChunkX = editChunkY = -1;
+    if (parentView)
+        parentView->updateScrollbars();
+    redraw();
+}
+
+void TilemapWindow::setTileColor(TileColor source) {
+    tileColor = source;
+    pyramidPages.clear();
+    frameValid = colorMapValid = false;
+    redraw();
+}
+
+void TilemapWindow::setCamera(float x, float y, float scale) {
+    offsetX = x;
+    offsetY = y;
+    zoom = scale;
+    if (parentView)
+        parentView->updateScrollbars();
+    redraw();
+}
+
+void TilemapWindow::setWorkerThreads(int count) {
+    // The GL thread fills a band too, so `count` threads need count - 1 workers
+    if (count > 1)
+        workerPool.reset(new ThreadPool(count - 1));
+    else
+        workerPool.reset();
+}
+
+void TilemapWindow::setStreaming(bool on) {
+    if (on == (streamer != nullptr))
+        return;
+    if (on) {
+        streamer.reset(new ChunkStreamer(STREAM_RESIDENT_BUDGET, [this](int cx, int cy, TileId* out) {
+            // Runs on the loader thread; this is where a mapped file takes its page faults
+            std::lock_guard<std::mutex> lock(storageMutex);
+            int x0 = cx * MAP_CHUNK_SIZE, y0 = cy * MAP_CHUNK_SIZE;
+            int cols = std::min(MAP_CHUNK_SIZE, tileMap.width() - x0);
+            int rows = std::min(MAP_CHUNK_SIZE, tileMap.height() - y0);
+            for (int r = 0; r < rows && cols > 0; ++r)
+                tileMap.decodeRow(y0 + r, x0, cols, 1, out + (size_t)r * MAP_CHUNK_SIZE);
+        }, chunksArrived, this));
+    } else {
+        streamer.reset();
+    }
+    frameValid = false;
+    redraw();
+}
+
+void TilemapWindow::chunksArrived(void* userdata) {
+    auto* self = static_cast<TilemapWindow*>(userdata);
+    if (self->streamer && self->streamer->installCompleted()) {
+        // Placeholders may be on screen (and in the saved frame) where the new chunks go
+        self->frameValid = false;
+        self->redraw();
+    }
+}
+
+void TilemapWindow::setBenchmarkMode(bool on) {
+    if (on == benchmarkMode)
+        return;
+    benchmarkMode = on;
+    if (on)
+        Fl::add_idle(benchmarkIdle, this);
+    else
+        Fl::remove_idle(benchmarkIdle, this);
+}
+
+void TilemapWindow::benchmarkIdle(void* userdata) {
+    auto* self = static_cast<TilemapWindow*>(userdata);
+    self->redraw(); // Continuous redraw for FPS measurement
+}
+
+void TilemapWindow::reportStats(void* userdata) {
+    // Only sums up the interval; the HUD shows the figures with the next frame drawn, so a
+    // still view stays still
+    TRACE_ZONE("stats");
+    auto* self = static_cast<TilemapWindow*>(userdata);
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - self->lastReportTime).count();
+    double idle = std::max(0.0, elapsed - self->busySinceReport);
+    self->idleSeconds += idle;
+    self->reportedFps = self->framesSinceReport / elapsed;
+    self->reportedIdle = 100.0 * idle / elapsed;
+
+    self->framesSinceReport = 0;
+    self->busySinceReport = 0.0;
+    self->lastReportTime = now;
+    Fl::repeat_timeout(STATS_INTERVAL, reportStats, userdata);
+}
+
+void TilemapWindow::updateTitle() {
+    // Only the active modes, so the label changes when they do rather than every second
+    if (!window())
+        return;
+    char title[sizeof(windowTitle)];
+    snprintf(title, sizeof(title), "Tilemap Viewer [%s, %s%s%s]", renderModeName(renderMode),
+             farZoomModeName(farZoomMode), scrollBlit ? ", scroll blit" : "", benchmarkMode ? ", benchmark" : "");
+    if (strcmp(title, windowTitle)) {
+        strcpy(windowTitle, title);
+        window()->copy_label(title);
+    }
+}
+
+void TilemapWindow::drawHud() {
+    // Window coordinates, over the map. Nothing here allocates, so the HUD does not disturb
+    // the frame times it shows.
+    const int graphFrames = 240;
+    const float graphH = 60.0f, graphMs = 100.0f / 3.0f; // The graph's top is two 60 Hz frames
+    const float x0 = 8.0f, y0 = 8.0f, panelW = graphFrames + 60.0f, lineH = 15.0f;
+    int lines = streamer ? 5 : 4;
+    float panelH = lines * lineH + graphH + 14.0f;
+
+    glDisable(GL_TEXTURE_2D);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glColor4f(0.0f, 0.0f, 0.0f, 0.6f);
+    glRectf(x0, y0, x0 + panelW, y0 + panelH);
+    glDisable(GL_BLEND);
+
+    // One bar per recent frame, newest on the right, drawn with a single call
+    size_t n = frameTimes.recent(hudSamples, graphFrames);
+    float baseY = y0 + panelH - 6.0f, graphX = x0 + panelW - 6.0f - n;
+    for (size_t i = 0; i < n; ++i) {
+        float x = graphX + i + 0.5f;
+        hudVertices[i * 4 + 0] = x;
+        hudVertices[i * 4 + 1] = baseY;
+        hudVertices[i * 4 + 2] = x;
+        hudVertices[i * 4 + 3] = baseY - std::min(graphH, hudSamples[i] / graphMs * graphH);
+    }
+    glColor3f(0.3f, 0.9f, 0.3f);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(2, GL_FLOAT, 0, hudVertices);
+    glDrawArrays(GL_LINES, 0, (GLsizei)(n * 2));
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    // 60 Hz budget
+    float budgetY = baseY - graphH * 0.5f;
+    glColor3f(0.9f, 0.3f, 0.3f);
+    glBegin(GL_LINES);
+    glVertex2f(x0 + 6.0f, budgetY);
+    glVertex2f(x0 + panelW - 6.0f, budgetY);
+    glEnd();
+
+    FrameStats stats = frameTimes.summarize();
+    char line[128];
+    glColor3f(1.0f, 1.0f, 1.0f);
+    gl_font(FL_HELVETICA, 12);
+    snprintf(line, sizeof(line), "frame p50 %.2f  p95 %.2f  p99 %.2f  max %.2f ms", stats.p50Ms, stats.p95Ms,
+             stats.p99Ms, stats.maxMs);
+    gl_draw(line, x0 + 6.0f, y0 + lineH);
+    snprintf(line, sizeof(line), "%.0f fps, %.0f%% idle, %lld frames", reportedFps, reportedIdle, framesRendered);
+    gl_draw(line, x0 + 6.0f, y0 + 2 * lineH);
+    const RenderStats& work = lastFrameWork;
+    snprintf(line, sizeof(line), "draws %zu  verts %zu  binds %zu  upload %.0f KB", work.drawCalls, work.vertices,
+             work.textureBinds, work.bytesUploaded / 1024.0);
+    gl_draw(line, x0 + 6.0f, y0 + 3 * lineH);
+    snprintf(line, sizeof(line), "tiles %zu drawn, %zu culled, step %d", work.tilesDrawn, work.tilesCulled,
+             work.lodStep);
+    gl_draw(line, x0 + 6.0f, y0 + 4 * lineH);
+    if (streamer) {
+        const ChunkStreamer::Stats& st = streamer->stats();
+        snprintf(line, sizeof(line), "stream hits %.1f%%, %llu stalls, %zu resident",
+                 st.lookups ? 100.0 * st.hits / st.lookups : 100.0, st.stalls, streamer->residentCount());
+        gl_draw(line, x0 + 6.0f, y0 + 5 * lineH);
+    }
+    glEnable(GL_TEXTURE_2D);
+}
+
+void TilemapWindow::loadTilesetAsync(const std::vector<std::string>& filenames, bool useCache) {
+    // One decode per image, so several images decode in parallel
+    tilesetPaths = filenames;
+    tilesetCache = useCache;
+    pendingDecodes = (int)filenames.size();
+    for (const std::string& path : filenames) {
+        tilesetSources.push_back(std::async(std::launch::async, [this, path, useCache] {
+            TRACE_THREAD("tileset decode");
+            DecodedImage image = loadImage(path.c_str(), useCache);
+            if (--pendingDecodes == 0)
+                startupTimeline.mark("tileset_decoded");
+            Fl::awake(tilesetArrived, this);
+            return image;
+        }));
+    }
+}
+
+void TilemapWindow::tilesetArrived(void* userdata) {
+    static_cast<TilemapWindow*>(userdata)->redraw();
+}
+
+// Takes the decoded tileset images once every background decode has finished, and derives the
+// per-tile colours from them. Never blocks: until it returns true, frames are drawn without the map.
+bool TilemapWindow::tilesetReady() {
+    if (!tilesetImages.empty())
+        return true;
+    if (tilesetSources.empty())
+        return false;
+    for (std::future<DecodedImage>& source : tilesetSources)
+        if (source.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return false;
+    for (std::future<DecodedImage>& source : tilesetSources) {
+        tilesetImages.push_back(source.get());
+        if (!tilesetImages.back().pixels)
+            exit(1); // loadImage() has said why
+    }
+    tilesetSources.clear();
+    indexTiles();
+    return true;
+}
+
+// Average colour of one tile, used wherever tiles are too small to show their texture
+static Rgba averageTileColor(const DecodedImage& image, int px, int py) {
+    unsigned sum[4] = {0, 0, 0, 0};
+    for (int y = py; y < py + TILE_SIZE; ++y) {
+        const unsigned char* row = image.pixels + ((size_t)y * image.width + px) * 4;
+        for (int x = 0; x < TILE_SIZE * 4; ++x)
+            sum[x & 3] += row[x];
+    }
+    const unsigned n = TILE_SIZE * TILE_SIZE;
+    return Rgba{(unsigned char)(sum[0] / n), (unsigned char)(sum[1] / n),
+                (unsigned char)(sum[2] / n), (unsigned char)(sum[3] / n)};
+}
+
+// Most common colour of one tile, an alternative to the average for tiles drawn as one texel
+static Rgba dominantTileColor(const DecodedImage& image, int px, int py) {
+    // Bucket the opaque pixels by their top five bits per channel and average the largest bucket
+    uint16_t keys[TILE_SIZE * TILE_SIZE];
+    int n = 0;
+    for (int y = py; y < py + TILE_SIZE; ++y) {
+        const unsigned char* p = image.pixels + ((size_t)y * image.width + px) * 4;
+        for (int x = 0; x < TILE_SIZE; ++x, p += 4)
+            if (p[3] >= 128)
+                keys[n++] = (uint16_t)((p[0] >> 3) << 10 | (p[1] >> 3) << 5 | (p[2] >> 3));
+    }
+    if (n == 0)
+        return averageTileColor(image, px, py);
+    std::sort(keys, keys + n);
+    uint16_t best = keys[0];
+    for (int i = 0, bestRun = 0; i < n;) {
+        int j = i;
+        while (j < n && keys[j] == keys[i])
+            ++j;
+        if (j - i > bestRun) {
+            bestRun = j - i;
+            best = keys[i];
+        }
+        i = j;
+    }
+    unsigned sum[3] = {0, 0, 0}, count = 0;
+    for (int y = py; y < py + TILE_SIZE; ++y) {
+        const unsigned char* p = image.pixels + ((size_t)y * image.width + px) * 4;
+        for (int x = 0; x < TILE_SIZE; ++x, p += 4) {
+            if (p[3] >= 128 && ((p[0] >> 3) << 10 | (p[1] >> 3) << 5 | (p[2] >> 3)) == best) {
+                sum[0] += p[0], sum[1] += p[1], sum[2] += p[2];
+                ++count;
+            }
+        }
+    }
+    return Rgba{(unsigned char)(sum[0] / count), (unsigned char)(sum[1] / count), (unsigned char)(sum[2] / count), 255};
+}
+
+// Numbers the tiles of every image and takes their colours
+void TilemapWindow::indexTiles() {
+    // Map tiles without a tileset tile stay black
+    tileOrigins.clear();
+    for (int i = 0; i < (int)tilesetImages.size(); ++i)
+        for (int py = 0; py + TILE_SIZE <= tilesetImages[i].height; py += TILE_SIZE)
+            for (int px = 0; px + TILE_SIZE <= tilesetImages[i].width; px += TILE_SIZE)
+                tileOrigins.push_back(TileOrigin{i, px, py});
+    tileCount = (int)tileOrigins.size();
+    if (tileCount > (int)TileStorage::maxTiles)
+        fprintf(stderr, "warning: the tileset has %d tiles but the map stores at most %u tile IDs; tiles %u and up "
+                "cannot be placed\n", tileCount, TileStorage::maxTiles, TileStorage::maxTiles);
+    tileAverage.assign(std::max<size_t>(tileCount, TileStorage::maxTiles), Rgba{0, 0, 0, 255});
+    tileDominant = tileAverage;
+    for (int t = 0; t < tileCount; ++t) {
+        const TileOrigin& o = tileOrigins[t];
+        tileAverage[t] = averageTileColor(tilesetImages[o.image], o.x, o.y);
+        tileDominant[t] = dominantTileColor(tilesetImages[o.image], o.x, o.y);
+    }
+}
+
+void TilemapWindow::uploadTileset() {
+    // Once per GL context: resizes and other invalidations keep the textures
+    if (tileCount == 0) {
+        fprintf(stderr, "error: the tileset has no %dx%d tiles\n", TILE_SIZE, TILE_SIZE);
+        exit(1);
+    }
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    int limit = atlasPageLimit > 0 ? std::min<int>(maxSize, atlasPageLimit) : maxSize;
+
+    // The smallest page that holds every tile, or as many pages of the largest size as needed
+    int pageSize = ATLAS_CELL;
+    while (pageSize * 2 <= limit && (pageSize / ATLAS_CELL) * (pageSize / ATLAS_CELL) < tileCount)
+        pageSize *= 2;
+    atlasCellsPerRow = pageSize / ATLAS_CELL;
+    int tilesPerPage = atlasCellsPerRow * atlasCellsPerRow;
+    size_t pageCount = (tileCount + tilesPerPage - 1) / tilesPerPage;
+
+    atlasPages.assign(pageCount, AtlasPage{pageSize, {}});
+    for (AtlasPage& page : atlasPages)
+        for (int size = pageSize; size >= 1; size /= 2)
+            page.levels.emplace_back((size_t)size * size, Rgba{0, 0, 0, 255});
+
+    size_t tableSize = std::max<size_t>(tileCount, TileStorage::maxTiles);
+    uvTable.assign(tableSize * 4, 0.0f);
+    tilePage.assign(tableSize, 0);
+    for (int t = 0; t < tileCount; ++t) {
+        int cell = t % tilesPerPage;
+        float* uv = &uvTable[(size_t)t * 4];
+        uv[0] = (float)((cell % atlasCellsPerRow) * ATLAS_CELL + TILE_GUTTER) / pageSize;
+        uv[1] = (float)((cell / atlasCellsPerRow) * ATLAS_CELL + TILE_GUTTER) / pageSize;
+        uv[2] = uv[0] + (float)TILE_SIZE / pageSize;
+        uv[3] = uv[1] + (float)TILE_SIZE / pageSize;
+        tilePage[t] = (uint16_t)(t / tilesPerPage);
+        fillAtlasCell(t);
+    }
+
+    pageTextures.assign(pageCount, 0);
+    glGenTextures((GLsizei)pageCount, pageTextures.data());
+    for (size_t p = 0; p < pageCount; ++p) {
+        AtlasPage& page = atlasPages[p];
+        refreshAtlasRegion(p, 0, 0, page.size, page.size, false);
+        bindTexture(pageTextures[p]);
+        // Crisp pixel edges from 1:1 up, filtered and mipmapped below it
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        for (size_t k = 0; k < page.levels.size(); ++k) {
+            glTexImage2D(GL_TEXTURE_2D, (GLint)k, GL_RGBA, page.size >> k, page.size >> k, 0, GL_RGBA,
+                         GL_UNSIGNED_BYTE, page.levels[k].data());
+            frameWork.bytesUploaded += page.levels[k].size() * sizeof(Rgba);
+        }
+    }
+    fprintf(logStream, "Tileset: %d tiles in %zu atlas page(s) of %dx%d (texture limit %d)\n", tileCount, pageCount, pageSize,
+            pageSize, limit);
+    startupTimeline.mark("texture_uploaded");
+}
+
+// Copies a tile into level 0 of its atlas cell, repeating its edge texels into the gutter
+void TilemapWindow::fillAtlasCell(int tile) {
+    const TileOrigin& origin = tileOrigins[tile];
+    const DecodedImage& image = tilesetImages[origin.image];
+    AtlasPage& page = atlasPages[tilePage[tile]];
+    int cell = tile % (atlasCellsPerRow * atlasCellsPerRow);
+    int cellX = (cell % atlasCellsPerRow) * ATLAS_CELL, cellY = (cell / atlasCellsPerRow) * ATLAS_CELL;
+    for (int y = 0; y < ATLAS_CELL; ++y) {
+        int sy = std::min(std::max(y - TILE_GUTTER, 0), TILE_SIZE - 1);
+        const unsigned char* src = image.pixels + ((size_t)(origin.y + sy) * image.width + origin.x) * 4;
+        Rgba* dst = &page.levels[0][(size_t)(cellY + y) * page.size + cellX];
+        for (int x = 0; x < ATLAS_CELL; ++x) {
+            int sx = std::min(std::max(x - TILE_GUTTER, 0), TILE_SIZE - 1);
+            memcpy(&dst[x], src + sx * 4, 4);
+        }
+    }
+}
+
+// Recomputes every mip level under a changed level-0 rectangle of a page (a 2x2 box filter),
+// and with `upload`, sends each level's rectangle to the bound texture
+void TilemapWindow::refreshAtlasRegion(size_t page, int x0, int y0, int x1, int y1, bool upload) {
+    AtlasPage& p = atlasPages[page];
+    for (size_t k = 0; k < p.levels.size(); ++k) {
+        int size = p.size >> k;
+        if (k > 0) {
+            x0 >>= 1, y0 >>= 1, x1 = (x1 + 1) >> 1, y1 = (y1 + 1) >> 1;
+            const Rgba* src = p.levels[k - 1].data();
+            Rgba* dst = p.levels[k].data();
+            for (int y = y0; y < y1; ++y) {
+                for (int x = x0; x < x1; ++x) {
+                    const Rgba* a = &src[(size_t)(2 * y) * (2 * size) + 2 * x];
+                    const Rgba* c = a + 2 * size;
+                    dst[(size_t)y * size + x] = Rgba{(unsigned char)((a[0].r + a[1].r + c[0].r + c[1].r + 2) / 4),
+                                                     (unsigned char)((a[0].g + a[1].g + c[0].g + c[1].g + 2) / 4),
+                                                     (unsigned char)((a[0].b + a[1].b + c[0].b + c[1].b + 2) / 4),
+                                                     (unsigned char)((a[0].a + a[1].a + c[0].a + c[1].a + 2) / 4)};
+                }
+            }
+        }
+        if (upload) {
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, size);
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, x0);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, y0);
+            glTexSubImage2D(GL_TEXTURE_2D, (GLint)k, x0, y0, x1 - x0, y1 - y0, GL_RGBA, GL_UNSIGNED_BYTE,
+                            p.levels[k].data());
+            frameWork.bytesUploaded += (size_t)(x1 - x0) * (y1 - y0) * sizeof(Rgba);
+        }
+    }
+    if (upload) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    }
+}
+
+void TilemapWindow::watchTileset() {
+    reloadRequested.assign(tilesetPaths.size(), false);
+#ifdef __linux__
+    // Watch the directories rather than the files: editors often save by writing a new file
+    // and renaming it over the old one, which would end a watch on the file itself
+    watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watchFd >= 0) {
+        for (const std::string& path : tilesetPaths) {
+            size_t slash = path.rfind('/');
+            std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+            watchIds.push_back(inotify_add_watch(watchFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO));
+        }
+        Fl::add_fd(watchFd, FL_READ, tilesetChanged, this);
+        return;
+    }
+    // Out of inotify instances, for example: fall back to polling like other platforms
+    fprintf(stderr, "warning: cannot watch the tileset (%s), polling it instead\n", strerror(errno));
+#endif
+    for (const std::string& path : tilesetPaths) {
+        struct stat st;
+        tilesetMtimes.push_back(stat(path.c_str(), &st) == 0 ? (int64_t)st.st_mtime : 0);
+    }
+    Fl::add_timeout(TILESET_POLL_INTERVAL, pollTileset, this);
+}
+
+void TilemapWindow::tilesetChanged(int fd, void* userdata) {
+#ifdef __linux__
+    auto* self = static_cast<TilemapWindow*>(userdata);
+    alignas(inotify_event) char buffer[4096];
+    bool changed = false;
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + n; p += sizeof(inotify_event) + ((inotify_event*)p)->len) {
+            const inotify_event* event = (const inotify_event*)p;
+            if (!event->len)
+                continue;
+            for (size_t i = 0; i < self->tilesetPaths.size(); ++i) {
+                const std::string& path = self->tilesetPaths[i];
+                size_t slash = path.rfind('/');
+                const char* name = path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+                if (self->watchIds[i] == event->wd && !strcmp(name, event->name)) {
+                    self->reloadRequested[i] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+    if (changed) {
+        // Saves often arrive as several events; reload once they have settled
+        Fl::remove_timeout(startReloads, self);
+        Fl::add_timeout(TILESET_RELOAD_DELAY, startReloads, self);
+    }
+#endif
+}
+
+void TilemapWindow::pollTileset(void* userdata) {
+    auto* self = static_cast<TilemapWindow*>(userdata);
+    bool changed = false;
+    for (size_t i = 0; i < self->tilesetPaths.size(); ++i) {
+        struct stat st;
+        if (stat(self->tilesetPaths[i].c_str(), &st) == 0 && (int64_t)st.st_mtime != self->tilesetMtimes[i]) {
+            self->tilesetMtimes[i] = (int64_t)st.st_mtime;
+            self->reloadRequested[i] = true;
+            changed = true;
+        }
+    }
+    if (changed)
+        startReloads(userdata);
+    Fl::repeat_timeout(TILESET_POLL_INTERVAL, pollTileset, userdata);
+}
+
+void TilemapWindow::startReloads(void* userdata) {
+    auto* self = static_cast<TilemapWindow*>(userdata);
+    for (size_t i = 0; i < self->reloadRequested.size(); ++i) {
+        if (!self->reloadRequested[i])
+            continue;
+        self->reloadRequested[i] = false;
+        std::string path = self->tilesetPaths[i];
+        bool useCache = self->tilesetCache;
+        // An older decode may finish after this one; only the newest pixels may be applied
+        for (PendingReload& pending : self->reloads)
+            if (pending.image == (int)i)
+                pending.superseded = true;
+        self->reloads.push_back(PendingReload{(int)i, std::async(std::launch::async, [self, path, useCache] {
+            TRACE_THREAD("tileset reload");
+            DecodedImage image = loadImage(path.c_str(), useCache);
+            Fl::awake(tilesetArrived, self);
+            return image;
+        })});
+    }
+}
+
+// Takes reloaded tileset images whose decode has finished (GL context current). Tiles are
+// compared with the previous image and only those that changed are uploaded. Cached vertex
+// data and display lists hold nothing but UVs, which stay the same, so they are kept; only
+// pyramid pages showing a changed tile are rebuilt.
+void TilemapWindow::applyTilesetReloads() {
+    if (reloads.empty())
+        return;
+    TRACE_ZONE("tileset reload");
+    for (auto it = reloads.begin(); it != reloads.end();) {
+        if (it->result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            ++it;
+            continue;
+        }
+        int i = it->image;
+        bool superseded = it->superseded;
+        DecodedImage image = it->result.get();
+        it = reloads.erase(it);
+        if (superseded)
+            continue;
+        if (!image.pixels)
+            continue; // loadImage() has said why; keep showing the old image
+        DecodedImage& old = tilesetImages[i];
+        if (image.width != old.width || image.height != old.height) {
+            // Tile IDs and pages may all have moved
+            fprintf(logStream, "Tileset %s: resized to %dx%d, reloading all tiles\n", tilesetPaths[i].c_str(), image.width,
+                    image.height);
+            old = std::move(image);
+            rebuildTileset();
+            continue;
+        }
+
+        int first = 0;
+        for (int k = 0; k < i; ++k)
+            first += (tilesetImages[k].width / TILE_SIZE) * (tilesetImages[k].height / TILE_SIZE);
+        int cols = image.width / TILE_SIZE, rows = image.height / TILE_SIZE;
+        std::vector<int> changed;
+        for (int r = 0; r < rows; ++r) {
+            for (int c = 0; c < cols; ++c) {
+                int px = c * TILE_SIZE, py = r * TILE_SIZE;
+                bool same = true;
+                for (int y = py; y < py + TILE_SIZE && same; ++y) {
+                    size_t offset = ((size_t)y * image.width + px) * 4;
+                    same = !memcmp(old.pixels + offset, image.pixels + offset, TILE_SIZE * 4);
+                }
+                if (!same)
+                    changed.push_back(first + r * cols + c);
+            }
+        }
+        old = std::move(image);
+        fprintf(logStream, "Tileset %s: %zu of %d tiles changed\n", tilesetPaths[i].c_str(), changed.size(), cols * rows);
+
+        // Each changed cell goes up through every mip level; the rest of the page is untouched
+        TileMask changedIds;
+        for (int t : changed) {
+            fillAtlasCell(t);
+            int cell = t % (atlasCellsPerRow * atlasCellsPerRow);
+            int cellX = (cell % atlasCellsPerRow) * ATLAS_CELL, cellY = (cell / atlasCellsPerRow) * ATLAS_CELL;
+            bindTexture(pageTextures[tilePage[t]]);
+            refreshAtlasRegion(tilePage[t], cellX, cellY, cellX + ATLAS_CELL, cellY + ATLAS_CELL, true);
+            tileAverage[t] = averageTileColor(old, tileOrigins[t].x, tileOrigins[t].y);
+            tileDominant[t] = dominantTileColor(old, tileOrigins[t].x, tileOrigins[t].y);
+            if (t < (int)TileStorage::maxTiles)
+                changedIds.set(t);
+        }
+
+        if (changedIds.any()) {
+            pyramidPages.invalidateIf([&](const ChunkKey&, GLuint tex) {
+                auto used = pyramidPageTiles.find(tex);
+                return used != pyramidPageTiles.end() && (used->second & changedIds).any();
+            });
+        }
+        if (!changed.empty())
+            frameValid = colorMapValid = false;
+    }
+}
+
+void TilemapWindow::rebuildTileset() {
+    // Display lists are released now, while their page count still matches atlasPages
+    chunkCache.clear();
+    chunkCache.releasePending();
+    pyramidPages.clear();
+    glDeleteTextures((GLsizei)pageTextures.size(), pageTextures.data());
+    pageTextures.clear();
+    indexTiles();
+    uploadTileset();
+    frameValid = colorMapValid = false;
+}
+
+void TilemapWindow::drawTile(int tileIndex, int x, int y, int size) {
+    // Texture rectangle of the tile within its page; the caller binds the page
+    const float* uv = &uvTable[(size_t)tileIndex * 4];
+
+    // Basic OpenGL immediate mode rendering for a single textured quad
+    countDraw(4);
+    glBegin(GL_QUADS);
+    glTexCoord2f(uv[0], uv[1]);   glVertex2f(x, y);
+    glTexCoord2f(uv[2], uv[1]);   glVertex2f(x + size, y);
+    glTexCoord2f(uv[2], uv[3]);   glVertex2f(x + size, y + size);
+    glTexCoord2f(uv[0], uv[3]);   glVertex2f(x, y + size);
+    glEnd();
+}
+
+size_t TilemapWindow::fillTileVertices(int tileX0, int tileY0, int tileX1, int tileY1, int step) {
+    int cols = (tileX1 - tileX0 + step - 1) / step;
+    int rows = (tileY1 - tileY0 + step - 1) / step;
+    if (cols <= 0 || rows <= 0)
+        return 0;
+
+    // Grow only; the buffer keeps its capacity for the following frames
+    size_t vertexCount = (size_t)cols * rows * 4;
+    if (vertexBuffer.size() < vertexCount)
+        vertexBuffer.resize(vertexCount);
+    TileVertex* out = vertexBuffer.data();
+    bool paged = atlasPages.size() > 1;
+    if (paged && quadPages.size() < vertexCount / 4)
+        quadPages.resize(vertexCount / 4);
+    uint16_t* pages = paged ? quadPages.data() : nullptr;
+
+    if (!workerPool || (size_t)cols * rows < (size_t)PARALLEL_MIN_TILES) {
+        fillTileRows(out, pages, tileX0, tileX1, tileY0, tileY1, step);
+        sortQuadsByPage(vertexCount / 4);
+        return vertexCount;
+    }
+
+    // Every sampled row owns a fixed slice of the array, so row bands can be written by
+    // different threads without any synchronisation beyond the final join
+    int bands = std::min(rows, (workerPool->size() + 1) * BANDS_PER_THREAD);
+    workerPool->parallelFor(bands, [&](int band) {
+        int rowBegin = rows * band / bands, rowEnd = rows * (band + 1) / bands;
+        fillTileRows(out + (size_t)rowBegin * cols * 4, pages ? pages + (size_t)rowBegin * cols : nullptr,
+                     tileX0, tileX1, tileY0 + rowBegin * step, std::min(tileY1, tileY0 + rowEnd * step), step);
+    });
+    sortQuadsByPage(vertexCount / 4);
+    return vertexCount;
+}
+
+// Groups the quads in vertexBuffer by atlas page (a stable counting sort), so each page is
+// one contiguous range drawn with one bind; with a single page this only sets the range
+void TilemapWindow::sortQuadsByPage(size_t quadCount) {
+    TRACE_ZONE("sort by page");
+    size_t pageCount = atlasPages.size();
+    pageFirst.assign(pageCount + 1, 0);
+    if (pageCount <= 1) {
+        pageFirst.back() = quadCount * 4;
+        return;
+    }
+    for (size_t q = 0; q < quadCount; ++q)
+        pageFirst[quadPages[q] + 1] += 4;
+    for (size_t p = 1; p <= pageCount; ++p)
+        pageFirst[p] += pageFirst[p - 1];
+
+    if (sortedVertices.size() < quadCount * 4)
+        sortedVertices.resize(quadCount * 4);
+    std::vector<size_t> next(pageFirst.begin(), pageFirst.end() - 1);
+    for (size_t q = 0; q < quadCount; ++q) {
+        memcpy(&sortedVertices[next[quadPages[q]]], &vertexBuffer[q * 4], 4 * sizeof(TileVertex));
+        next[quadPages[q]] += 4;
+    }
+    vertexBuffer.swap(sortedVertices);
+}
 
-class TilemapScrollView; // Forward declare
+void TilemapWindow::fillTileRows(TileVertex* out, uint16_t* pages, int tileX0, int tileX1, int rowY0, int rowY1,
+                                 int step) const {
+    TRACE_ZONE("fill rows");
+    int cols = (tileX1 - tileX0 + step - 1) / step;
+    float size = (float)(TILE_SIZE * step);
 
-class TilemapWindow : public Fl_Gl_Window {
-public:
-    TilemapWindow(int x, int y, int w, int h);
-    ~TilemapWindow();
+    // Decode one sampled row at a time into a small per-thread buffer that stays in L1
+    thread_local std::vector<TileId> row;
+    if (row.size() < (size_t)cols)
+        row.resize(cols);
 
-    void draw() override;
-    int handle(int event) override;
+    // Same quads as drawTile, written into the array instead of issued one by one
+    for (int y = rowY0; y < rowY1; y += step) {
+        readRow(y, tileX0, cols, step, row.data());
+        quadKernel(out, row.data(), cols, (float)(tileX0 * TILE_SIZE), (float)(y * TILE_SIZE), size, uvTable.data());
+        out += (size_t)cols * 4;
+        if (pages) {
+            for (int i = 0; i < cols; ++i)
+                pages[i] = tilePage[row[i]];
+            pages += cols;
+        }
+    }
+}
 
-    void loadTileset(const char* filename);
-    void drawTile(int tileIndex, int x, int y, int size);
-    void updateHoveredTile(int mouseX, int mouseY);
+// Sampled row of tiles as the renderer sees it. With streaming, step-1 rows come from resident
+// chunks, and chunks that have not arrived show their pyramid block instead of stalling the frame.
+void TilemapWindow::readRow(int y, int x0, int count, int step, TileId* out) const {
+    if (!streamer || step != 1) {
+        tileMap.decodeRow(y, x0, count, step, out);
+        return;
+    }
+    int cy = y >> MAP_CHUNK_SHIFT;
+    size_t rowOffset = (size_t)(y & (MAP_CHUNK_SIZE - 1)) * MAP_CHUNK_SIZE;
+    for (int x = x0, end = x0 + count; x < end;) {
+        int cx = x >> MAP_CHUNK_SHIFT, col = x & (MAP_CHUNK_SIZE - 1);
+        int n = std::min(end - x, MAP_CHUNK_SIZE - col);
+        if (const TileId* tiles = streamer->find(cx, cy))
+            memcpy(out, tiles + rowOffset + col, n * sizeof(TileId));
+        else
+            std::fill(out, out + n, placeholderTile(cx, cy));
+        out += n;
+        x += n;
+    }
+}
 
-    // Shared view state
-    float offsetX = 0.0f, offsetY = 0.0f;
-    float zoom = 1.0f;
-    TilemapScrollView* parentView = nullptr;
+TileId TilemapWindow::placeholderTile(int cx, int cy) const {
+    // The pyramid block covering the whole chunk, or the coarsest one a small map has
+    int level = std::min(MAP_CHUNK_SHIFT, pyramid.levelCount() - 1);
+    if (level == 0)
+        return 0;
+    int shift = MAP_CHUNK_SHIFT - level;
+    return pyramid.tileAt(level, std::min(cx << shift, pyramid.levelWidth(level) - 1),
+                          std::min(cy << shift, pyramid.levelHeight(level) - 1));
+}
 
-private:
-    GLuint tilesetTexture = 0;
-    int tilesetWidth = 0, tilesetHeight = 0;
-    int tileMap[MAP_HEIGHT][MAP_WIDTH];
+void TilemapWindow::updateStreaming() {
+    float pixelsPerTile = TILE_SIZE * zoom;
+    if (!streamer || pixelsPerTile < MIN_VISIBLE_PIXELS)
+        return; // Sampled and pyramid views read storage (or the pyramid) directly
 
-    int lastMouseX = 0, lastMouseY = 0;
-    bool dragging = false;
-    int hoveredX = -1, hoveredY = -1;
+    float chunkPixels = pixelsPerTile * MAP_CHUNK_SIZE;
+    int chunksX = tileMap.chunkColumns(), chunksY = tileMap.chunkRows();
+    int cx0 = std::max(0, (int)std::floor(-offsetX / chunkPixels));
+    int cy0 = std::max(0, (int)std::floor(-offsetY / chunkPixels));
+    int cx1 = std::min(chunksX, (int)std::ceil((w() - offsetX) / chunkPixels));
+    int cy1 = std::min(chunksY, (int)std::ceil((h() - offsetY) / chunkPixels));
 
-    std::chrono::steady_clock::time_point lastFpsTime;
-    int frames = 0;
-};
+    std::vector<uint64_t> visible, prefetch;
+    for (int cy = cy0; cy < cy1; ++cy)
+        for (int cx = cx0; cx < cx1; ++cx)
+            visible.push_back(ChunkStreamer::key(cx, cy));
 
-class TilemapScrollView : public Fl_Group {
-public:
-    TilemapWindow* canvas;
-    Fl_Scrollbar* hscroll;
-    Fl_Scrollbar* vscroll;
+    // Where the view will be PREFETCH_SECONDS from now at the current pan velocity (dragging
+    // the map right moves the view left), plus one chunk all round for slow changes of direction
+    bool panning = dragging && std::chrono::duration<double>(std::chrono::steady_clock::now() - lastDragTime).count() <
+                               PAN_IDLE_SECONDS;
+    float leadX = panning ? -panVelocityX * PREFETCH_SECONDS / chunkPixels : 0.0f;
+    float leadY = panning ? -panVelocityY * PREFETCH_SECONDS / chunkPixels : 0.0f;
+    int px0 = std::max(0, cx0 - 1 + std::min(0, (int)std::floor(leadX)));
+    int py0 = std::max(0, cy0 - 1 + std::min(0, (int)std::floor(leadY)));
+    int px1 = std::min(chunksX, cx1 + 1 + std::max(0, (int)std::ceil(leadX)));
+    int py1 = std::min(chunksY, cy1 + 1 + std::max(0, (int)std::ceil(leadY)));
+    for (int cy = py0; cy < py1; ++cy)
+        for (int cx = px0; cx < px1; ++cx)
+            if (cx < cx0 || cx >= cx1 || cy < cy0 || cy >= cy1)
+                prefetch.push_back(ChunkStreamer::key(cx, cy));
 
-    TilemapScrollView(int X, int Y, int W, int H);
-    void updateScrollbars();
-    void resize(int X, int Y, int W, int H) override;
-};
+    // Nearest first, so the chunks the pan reaches next are the next to load
+    float centerX = (cx0 + cx1) * 0.5f, centerY = (cy0 + cy1) * 0.5f;
+    auto distance = [&](uint64_t k) {
+        float dx = (float)(uint32_t)k + 0.5f - centerX, dy = (float)(k >> 32) + 0.5f - centerY;
+        return dx * dx + dy * dy;
+    };
+    std::sort(prefetch.begin(), prefetch.end(), [&](uint64_t a, uint64_t b) { return distance(a) < distance(b); });
+    streamer->request(visible, prefetch);
+}
 
-// =============== TilemapWindow Implementation ==================
+void TilemapWindow::drawTilesBatched(int tileX0, int tileY0, int tileX1, int tileY1, int step) {
+    size_t vertexCount = fillTileVertices(tileX0, tileY0, tileX1, tileY1, step);
+    if (vertexCount == 0)
+        return;
 
-TilemapWindow::TilemapWindow(int x, int y, int w, int h)
-    : Fl_Gl_Window(x, y, w, h) {
-    mode(FL_RGB | FL_DOUBLE | FL_DEPTH); // Enable double-buffering for smooth drawing
+    // Vertex arrays are core in OpenGL 1.1, so this path keeps the same compatibility
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(TileVertex), &vertexBuffer[0].u);
+    glVertexPointer(2, GL_FLOAT, sizeof(TileVertex), &vertexBuffer[0].x);
+    for (size_t p = 0; p < atlasPages.size(); ++p) {
+        if (pageFirst[p] == pageFirst[p + 1])
+            continue;
+        bindTexture(pageTextures[p]);
+        glDrawArrays(GL_QUADS, (GLint)pageFirst[p], (GLsizei)(pageFirst[p + 1] - pageFirst[p]));
+        countDraw(pageFirst[p + 1] - pageFirst[p]);
+    }
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
 
-    // Fill the tilemap with random tile indices
-    for (int y = 0; y < MAP_HEIGHT; ++y)
-        for (int x = 0; x < MAP_WIDTH; ++x)
-            tileMap[y][x] = rand() % (TILES_PER_ROW * TILES_PER_ROW);
+GLuint TilemapWindow::compileChunk(const ChunkKey& key) {
+    TRACE_ZONE("compile chunk");
+    // Chunks sample tiles on multiples of `step` from the map origin (not from the
+    // viewport edge), so a compiled chunk stays valid while panning
+    int span = CHUNK_SIZE * key.step;
+    int x0 = key.cx * span, y0 = key.cy * span;
+    int x1 = std::min(tileMap.width(), x0 + span), y1 = std::min(tileMap.height(), y0 + span);
 
-    Fl::add_idle([](void* userdata) {
-        auto* self = static_cast<TilemapWindow*>(userdata);
-        self->redraw(); // Continuous redraw for smooth FPS updates
-    }, this);
+    GLsizei pageCount = (GLsizei)atlasPages.size();
+    GLuint lists = glGenLists(pageCount);
+    if (!lists)
+        return 0;
+    size_t vertexCount = fillTileVertices(x0, y0, x1, y1, key.step);
+    std::vector<size_t>& counts = chunkVertices[lists];
+    counts.assign(pageCount, 0);
+
+    // List `lists + p` holds the chunk's quads on page p, without the bind, so the caller can
+    // draw every chunk's share of a page under a single bind. Arrays are dereferenced at
+    // compile time, so each list owns a copy of its geometry.
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    if (vertexCount) {
+        glTexCoordPointer(2, GL_FLOAT, sizeof(TileVertex), &vertexBuffer[0].u);
+        glVertexPointer(2, GL_FLOAT, sizeof(TileVertex), &vertexBuffer[0].x);
+    }
+    for (GLsizei p = 0; p < pageCount; ++p) {
+        glNewList(lists + p, GL_COMPILE);
+        if (vertexCount && pageFirst[p] != pageFirst[p + 1]) {
+            glDrawArrays(GL_QUADS, (GLint)pageFirst[p], (GLsizei)(pageFirst[p + 1] - pageFirst[p]));
+            counts[p] = pageFirst[p + 1] - pageFirst[p];
+        }
+        glEndList();
+    }
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    return lists;
 }
 
-TilemapWindow::~TilemapWindow() {
-    if (tilesetTexture)
-        glDeleteTextures(1, &tilesetTexture);
+void TilemapWindow::drawTilesChunked(int tileX0, int tileY0, int tileX1, int tileY1, int step) {
+    int span = CHUNK_SIZE * step;
+    int cx0 = tileX0 / span, cy0 = tileY0 / span;
+    int cx1 = (tileX1 + span - 1) / span, cy1 = (tileY1 + span - 1) / span;
+
+    std::vector<GLuint> visible;
+    for (int cy = cy0; cy < cy1; ++cy) {
+        for (int cx = cx0; cx < cx1; ++cx) {
+            ChunkKey key{cx, cy, step};
+            if (streamer && step == 1 && !streamer->find(cx, cy)) {
+                // Still streaming in: draw the placeholder, but do not keep it
+                drawTilesBatched(cx * span, cy * span, std::min(tileMap.width(), (cx + 1) * span),
+                                 std::min(tileMap.height(), (cy + 1) * span), step);
+                continue;
+            }
+            GLuint list = chunkCache.find(key);
+            if (!list) {
+                list = compileChunk(key);
+                if (!list)
+                    continue;
+                chunkCache.insert(key, list);
+            }
+            visible.push_back(list);
+        }
+    }
+
+    // Page-major, so each page is bound once however many chunks use it
+    for (size_t p = 0; p < atlasPages.size(); ++p) {
+        bindTexture(pageTextures[p]);
+        for (GLuint list : visible) {
+            glCallList(list + (GLuint)p);
+            countDraw(chunkVertices[list][p]);
+        }
+    }
 }
 
-void TilemapWindow::loadTileset(const char* filename) {
-    int n;
-    unsigned char* data = stbi_load(filename, &tilesetWidth, &tilesetHeight, &n, 4);
-    if (!data) {
-        fprintf(stderr, "Failed to load image: %s\n", filename);
-        exit(1);
+GLuint TilemapWindow::buildPyramidPage(const ChunkKey& key) {
+    TRACE_ZONE("build pyramid page");
+    int level = 0;
+    while ((1 << level) < key.step)
+        ++level;
+    int levelW = level == 0 ? tileMap.width() : pyramid.levelWidth(level);
+    int levelH = level == 0 ? tileMap.height() : pyramid.levelHeight(level);
+
+    // One texel per block; texels past the map edge stay unused (the quad is clipped)
+    pageBuffer.assign((size_t)PYRAMID_PAGE_SIZE * PYRAMID_PAGE_SIZE, Rgba{0, 0, 0, 0});
+    int x0 = key.cx * PYRAMID_PAGE_SIZE, y0 = key.cy * PYRAMID_PAGE_SIZE;
+    int x1 = std::min(levelW, x0 + PYRAMID_PAGE_SIZE), y1 = std::min(levelH, y0 + PYRAMID_PAGE_SIZE);
+    TileId row[PYRAMID_PAGE_SIZE];
+    const std::vector<Rgba>& colors = tileColors();
+    TileMask used;
+    for (int y = y0; y < y1; ++y) {
+        Rgba* out = &pageBuffer[(size_t)(y - y0) * PYRAMID_PAGE_SIZE];
+        if (level == 0)
+            tileMap.decodeRow(y, x0, x1 - x0, 1, row);
+        for (int x = x0; x < x1; ++x) {
+            int tile = level == 0 ? row[x - x0] : pyramid.tileAt(level, x, y);
+            *out++ = colors[tile];
+            used.set(tile);
+        }
     }
 
-    // Upload the tileset as a texture to the GPU
-    glGenTextures(1, &tilesetTexture);
-    glBindTexture(GL_TEXTURE_2D, tilesetTexture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // Crisp pixel edges
+    GLuint tex;
+    glGenTextures(1, &tex);
+    pyramidPageTiles[tex] = used;
+    bindTexture(tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tilesetWidth, tilesetHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-    stbi_image_free(data);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, PYRAMID_PAGE_SIZE, PYRAMID_PAGE_SIZE, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, pageBuffer.data());
+    frameWork.bytesUploaded += pageBuffer.size() * sizeof(Rgba);
+    return tex;
 }
 
-void TilemapWindow::drawTile(int tileIndex, int x, int y, int size) {
-    // Calculate texture coordinates for a specific tile index in the atlas
-    float u = (tileIndex % TILES_PER_ROW) * (float)TILE_SIZE / tilesetWidth;
-    float v = (tileIndex / TILES_PER_ROW) * (float)TILE_SIZE / tilesetHeight;
-    float du = (float)TILE_SIZE / tilesetWidth;
-    float dv = (float)TILE_SIZE / tilesetHeight;
+int TilemapWindow::pyramidLevelFor(float pixelsPerTile) const {
+    // The finest level whose blocks are still at least one pixel wide, so every texel maps to
+    // a pixel and nothing shimmers while panning
+    int level = 0;
+    while (level + 1 < pyramid.levelCount() && pixelsPerTile * (1 << level) < 1.0f)
+        ++level;
+    return level;
+}
 
-    // Basic OpenGL immediate mode rendering for a single textured quad
-    glBegin(GL_QUADS);
-    glTexCoord2f(u, v);             glVertex2f(x, y);
-    glTexCoord2f(u + du, v);        glVertex2f(x + size, y);
-    glTexCoord2f(u + du, v + dv);   glVertex2f(x + size, y + size);
-    glTexCoord2f(u, v + dv);        glVertex2f(x, y + size);
-    glEnd();
+void TilemapWindow::drawPyramid(float viewLeft, float viewTop, float viewRight, float viewBottom,
+                                float pixelsPerTile) {
+    int level = pyramidLevelFor(pixelsPerTile);
+    int blockTiles = 1 << level;
+    int levelW = level == 0 ? tileMap.width() : pyramid.levelWidth(level);
+    int levelH = level == 0 ? tileMap.height() : pyramid.levelHeight(level);
+
+    float pageWorld = (float)PYRAMID_PAGE_SIZE * blockTiles * TILE_SIZE;
+    int px0 = std::max(0, (int)std::floor(viewLeft / pageWorld));
+    int py0 = std::max(0, (int)std::floor(viewTop / pageWorld));
+    int px1 = std::min((levelW + PYRAMID_PAGE_SIZE - 1) / PYRAMID_PAGE_SIZE, (int)std::ceil(viewRight / pageWorld));
+    int py1 = std::min((levelH + PYRAMID_PAGE_SIZE - 1) / PYRAMID_PAGE_SIZE, (int)std::ceil(viewBottom / pageWorld));
+
+    for (int py = py0; py < py1; ++py) {
+        for (int px = px0; px < px1; ++px) {
+            ChunkKey key{px, py, blockTiles};
+            GLuint tex = pyramidPages.find(key);
+            if (!tex) {
+                tex = buildPyramidPage(key);
+                pyramidPages.insert(key, tex);
+            }
+            bindTexture(tex);
+
+            // Clip the page quad to the map so unused texels past the edge are never shown
+            int texelsW = std::min(PYRAMID_PAGE_SIZE, levelW - px * PYRAMID_PAGE_SIZE);
+            int texelsH = std::min(PYRAMID_PAGE_SIZE, levelH - py * PYRAMID_PAGE_SIZE);
+            float x0 = px * pageWorld, y0 = py * pageWorld;
+            float x1 = std::min((float)tileMap.width() * TILE_SIZE, x0 + (float)texelsW * blockTiles * TILE_SIZE);
+            float y1 = std::min((float)tileMap.height() * TILE_SIZE, y0 + (float)texelsH * blockTiles * TILE_SIZE);
+            float u1 = (float)texelsW / PYRAMID_PAGE_SIZE, v1 = (float)texelsH / PYRAMID_PAGE_SIZE;
+
+            countDraw(4);
+            glBegin(GL_QUADS);
+            glTexCoord2f(0, 0);   glVertex2f(x0, y0);
+            glTexCoord2f(u1, 0);  glVertex2f(x1, y0);
+            glTexCoord2f(u1, v1); glVertex2f(x1, y1);
+            glTexCoord2f(0, v1);  glVertex2f(x0, y1);
+            glEnd();
+        }
+    }
 }
 
-void TilemapWindow::draw() {
-    if (!valid()) {
-        // Only initialize OpenGL context and projection once
-        glLoadIdentity();
-        glOrtho(0, w(), h(), 0, -1, 1); // Set up orthographic 2D projection
-        loadTileset("tileset.png");
-        glEnable(GL_TEXTURE_2D);
-        lastFpsTime = std::chrono::steady_clock::now();
+void TilemapWindow::drawColorMap(float viewLeft, float viewTop, float viewRight, float viewBottom,
+                                 float pixelsPerTile) {
+    int level = pyramidLevelFor(pixelsPerTile);
+    int blockTiles = 1 << level;
+    int levelW = level == 0 ? tileMap.width() : pyramid.levelWidth(level);
+    int levelH = level == 0 ? tileMap.height() : pyramid.levelHeight(level);
+    float blockWorld = (float)blockTiles * TILE_SIZE;
+    ColorMapView view{level, std::max(0, (int)std::floor(viewLeft / blockWorld)),
+                      std::max(0, (int)std::floor(viewTop / blockWorld)),
+                      std::min(levelW, (int)std::ceil(viewRight / blockWorld)),
+                      std::min(levelH, (int)std::ceil(viewBottom / blockWorld))};
+    int cols = view.x1 - view.x0, rows = view.y1 - view.y0;
+    if (cols <= 0 || rows <= 0)
+        return;
+
+    // Blocks are at least a pixel wide, so the texture never needs to be larger than the window
+    if (!colorMapTexture || colorMapTexW < cols || colorMapTexH < rows) {
+        colorMapTexW = colorMapTexH = 1;
+        while (colorMapTexW < cols) colorMapTexW *= 2;
+        while (colorMapTexH < rows) colorMapTexH *= 2;
+        if (!colorMapTexture)
+            glGenTextures(1, &colorMapTexture);
+        bindTexture(colorMapTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, colorMapTexW, colorMapTexH, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        colorMapValid = false;
     }
+    bindTexture(colorMapTexture);
 
-    glClearColor(0.1f, 0.1f, 0.1f, 1);
-    glClear(GL_COLOR_BUFFER_BIT);
+    if (!colorMapValid || !(view == colorMapView)) {
+        TRACE_ZONE("color map fill");
+        colorMapBuffer.resize((size_t)cols * rows);
+        const Rgba* colors = tileColors().data();
+        auto fillRows = [&](int rowBegin, int rowEnd) {
+            thread_local std::vector<TileId> row;
+            if (row.size() < (size_t)cols)
+                row.resize(cols);
+            for (int r = rowBegin; r < rowEnd; ++r) {
+                Rgba* out = &colorMapBuffer[(size_t)r * cols];
+                if (level == 0) {
+                    tileMap.decodeRow(view.y0 + r, view.x0, cols, 1, row.data());
+                    for (int i = 0; i < cols; ++i)
+                        out[i] = colors[row[i]];
+                } else {
+                    for (int i = 0; i < cols; ++i)
+                        out[i] = colors[pyramid.tileAt(level, view.x0 + i, view.y0 + r)];
+                }
+            }
+        };
+        if (workerPool && (size_t)cols * rows >= (size_t)PARALLEL_MIN_TILES) {
+            int bands = std::min(rows, (workerPool->size() + 1) * BANDS_PER_THREAD);
+            workerPool->parallelFor(bands, [&](int band) { fillRows(rows * band / bands, rows * (band + 1) / bands); });
+        } else {
+            fillRows(0, rows);
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, cols, rows, GL_RGBA, GL_UNSIGNED_BYTE, colorMapBuffer.data());
+        frameWork.bytesUploaded += colorMapBuffer.size() * sizeof(Rgba);
+        colorMapView = view;
+        colorMapValid = true;
+    }
 
-    glPushMatrix();
-    glTranslatef(offsetX, offsetY, 0); // Apply panning
-    glScalef(zoom, zoom, 1.0f);        // Apply zoom scaling
+    // Clipped to the map like the pyramid pages
+    float x0 = view.x0 * blockWorld, y0 = view.y0 * blockWorld;
+    float x1 = std::min((float)tileMap.width() * TILE_SIZE, view.x1 * blockWorld);
+    float y1 = std::min((float)tileMap.height() * TILE_SIZE, view.y1 * blockWorld);
+    float u1 = (float)cols / colorMapTexW, v1 = (float)rows / colorMapTexH;
+    countDraw(4);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 0);   glVertex2f(x0, y0);
+    glTexCoord2f(u1, 0);  glVertex2f(x1, y0);
+    glTexCoord2f(u1, v1); glVertex2f(x1, y1);
+    glTexCoord2f(0, v1);  glVertex2f(x0, y1);
+    glEnd();
+}
 
+// Finds the part of the map visible in the given screen rectangle at the current pan and zoom
+ViewRange TilemapWindow::visibleRange(int screenX0, int screenY0, int screenX1, int screenY1) const {
+    TRACE_ZONE("visibility");
+    ViewRange view;
     // Compute visible world bounds in tile space
     float invZoom = 1.0f / zoom;
-    float viewLeft = -offsetX * invZoom;
-    float viewTop = -offsetY * invZoom;
-    float viewRight = (w() - offsetX) * invZoom;
-    float viewBottom = (h() - offsetY) * invZoom;
+    view.left = (screenX0 - offsetX) * invZoom;
+    view.top = (screenY0 - offsetY) * invZoom;
+    view.right = (screenX1 - offsetX) * invZoom;
+    view.bottom = (screenY1 - offsetY) * invZoom;
 
     // Determine the visible tile range in the current viewport.
     // This acts as a form of *view frustum culling* in tile space.
@@ -168,33 +3433,197 @@ void TilemapWindow::draw() {
     // floor(): ensures we start drawing from the first partially visible tile
     // ceil(): ensures we include the last partially visible tile
     //
-    // The result is clamped to the tilemap bounds (0 to MAP_WIDTH/HEIGHT)
+    // The result is clamped to the tilemap bounds (0 to the map width/height)
     // to avoid accessing out-of-bounds tile data.
-    int tileX0 = std::max(0, (int)std::floor(viewLeft / TILE_SIZE));
-    int tileY0 = std::max(0, (int)std::floor(viewTop / TILE_SIZE));
-    int tileX1 = std::min(MAP_WIDTH,  (int)std::ceil(viewRight / TILE_SIZE));
-    int tileY1 = std::min(MAP_HEIGHT, (int)std::ceil(viewBottom / TILE_SIZE));
-
-    glBindTexture(GL_TEXTURE_2D, tilesetTexture);
+    view.tileX0 = std::max(0, (int)std::floor(view.left / TILE_SIZE));
+    view.tileY0 = std::max(0, (int)std::floor(view.top / TILE_SIZE));
+    view.tileX1 = std::min(tileMap.width(),  (int)std::ceil(view.right / TILE_SIZE));
+    view.tileY1 = std::min(tileMap.height(), (int)std::ceil(view.bottom / TILE_SIZE));
 
     // Skip over tiles when zoomed out too far to reduce draw calls.
     // Instead of drawing 1000x1000 tiles at 1px each, draw representative tiles at larger size.
-    float pixelsPerTile = TILE_SIZE * zoom;
-    int step = std::max(1, (int)std::ceil(MIN_VISIBLE_PIXELS / pixelsPerTile));
+    view.pixelsPerTile = TILE_SIZE * zoom;
+    view.step = std::max(1, (int)std::ceil(MIN_VISIBLE_PIXELS / view.pixelsPerTile));
+
+    // Sample on multiples of `step` from the map origin so the chosen tiles do not change
+    // as the view pans, and partial redraws line up with the rest of the frame
+    view.tileX0 -= view.tileX0 % view.step;
+    view.tileY0 -= view.tileY0 % view.step;
+    return view;
+}
+
+// Draws the part of the map visible in the given screen rectangle (the pan/zoom transform
+// must already be applied)
+void TilemapWindow::drawMap(int screenX0, int screenY0, int screenX1, int screenY1) {
+    ViewRange view = visibleRange(screenX0, screenY0, screenX1, screenY1);
+    int tileX0 = view.tileX0, tileY0 = view.tileY0, tileX1 = view.tileX1, tileY1 = view.tileY1, step = view.step;
+    frameWork.tilesDrawn += (size_t)std::max(0, tileX1 - tileX0) * std::max(0, tileY1 - tileY0);
+    frameWork.lodStep = step;
+
+    TRACE_ZONE("tiles");
+    if (step > 1 && farZoomMode == FarZoomMode::Pyramid) {
+        // Bounded by the number of screen pixels, not by how many tiles are in view
+        drawPyramid(view.left, view.top, view.right, view.bottom, view.pixelsPerTile);
+    } else if (step > 1 && farZoomMode == FarZoomMode::ColorMap) {
+        // Also bounded by screen pixels, with one texture and one quad
+        drawColorMap(view.left, view.top, view.right, view.bottom, view.pixelsPerTile);
+    } else if (renderMode == RenderMode::VertexArray) {
+        drawTilesBatched(tileX0, tileY0, tileX1, tileY1, step);
+    } else if (renderMode == RenderMode::DisplayList) {
+        drawTilesChunked(tileX0, tileY0, tileX1, tileY1, step);
+    } else {
+        int cols = std::max(0, (tileX1 - tileX0 + step - 1) / step);
+        int rows = std::max(0, (tileY1 - tileY0 + step - 1) / step);
+        std::vector<TileId> tiles((size_t)cols * rows);
+        for (int r = 0; r < rows; ++r)
+            readRow(tileY0 + r * step, tileX0, cols, step, &tiles[(size_t)r * cols]);
+        // One pass per atlas page, so the page is bound once rather than per tile
+        for (size_t p = 0; p < atlasPages.size(); ++p) {
+            bindTexture(pageTextures[p]);
+            for (int r = 0; r < rows; ++r)
+                for (int i = 0; i < cols; ++i)
+                    if (tilePage[tiles[(size_t)r * cols + i]] == p)
+                        drawTile(tiles[(size_t)r * cols + i], (tileX0 + i * step) * TILE_SIZE,
+                                 (tileY0 + r * step) * TILE_SIZE, TILE_SIZE * step);
+        }
+    }
+}
+
+bool TilemapWindow::canReuseFrame(int& shiftX, int& shiftY) const {
+    if (!frameValid || zoom != frameZoom || w() != frameW || h() != frameH)
+        return false;
+    float dx = offsetX - frameOffsetX, dy = offsetY - frameOffsetY;
+    shiftX = (int)std::lround(dx);
+    shiftY = (int)std::lround(dy);
+    // Only whole-pixel shifts reproduce the frame exactly; anything else redraws in full
+    if (std::fabs(dx - shiftX) > 1e-3f || std::fabs(dy - shiftY) > 1e-3f)
+        return false;
+    return std::abs(shiftX) < w() && std::abs(shiftY) < h();
+}
+
+void TilemapWindow::drawPreviousFrame(int shiftX, int shiftY) {
+    // The copy is bottom-up (window coordinates) while the projection is top-down
+    float u1 = (float)frameW / frameTexW, v1 = (float)frameH / frameTexH;
+    float x0 = (float)shiftX, y0 = (float)shiftY;
+    float x1 = x0 + frameW, y1 = y0 + frameH;
+    bindTexture(frameTexture);
+    countDraw(4);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, v1);  glVertex2f(x0, y0);
+    glTexCoord2f(u1, v1); glVertex2f(x1, y0);
+    glTexCoord2f(u1, 0);  glVertex2f(x1, y1);
+    glTexCoord2f(0, 0);   glVertex2f(x0, y1);
+    glEnd();
+}
+
+void TilemapWindow::drawExposed(int screenX0, int screenY0, int screenX1, int screenY1) {
+    glScissor(screenX0, h() - screenY1, screenX1 - screenX0, screenY1 - screenY0);
+    drawMap(screenX0, screenY0, screenX1, screenY1);
+}
+
+void TilemapWindow::captureFrame() {
+    if (!frameTexture || frameTexW < w() || frameTexH < h()) {
+        // GL 1.1 textures must be a power of two in each dimension
+        frameTexW = frameTexH = 1;
+        while (frameTexW < w()) frameTexW *= 2;
+        while (frameTexH < h()) frameTexH *= 2;
+        if (!frameTexture)
+            glGenTextures(1, &frameTexture);
+        bindTexture(frameTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frameTexW, frameTexH, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    }
+    bindTexture(frameTexture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, w(), h());
+
+    frameValid = true;
+    frameOffsetX = offsetX;
+    frameOffsetY = offsetY;
+    frameZoom = zoom;
+    frameW = w();
+    frameH = h();
+}
 
-    for (int y = tileY0; y < tileY1; y += step) {
-        for (int x = tileX0; x < tileX1; x += step) {
-            int tile = tileMap[y][x];
-            drawTile(tile, x * TILE_SIZE, y * TILE_SIZE, TILE_SIZE * step);
+void TilemapWindow::draw() {
+    TRACE_ZONE("draw");
+    frameWork = RenderStats();
+    if (!valid()) {
+        // Only initialize OpenGL context and projection once
+        glLoadIdentity();
+        glOrtho(0, w(), h(), 0, -1, 1); // Set up orthographic 2D projection
+        if (!context_valid()) {
+            // Display lists and textures died with the old context
+            chunkCache.reset();
+            chunkVertices.clear();
+            pyramidPages.reset();
+            pyramidPageTiles.clear();
+            frameTexture = 0;
+            colorMapTexture = 0;
+            pageTextures.clear();
+        }
+        frameValid = false;
+        glEnable(GL_TEXTURE_2D);
+    }
+
+    if (pageTextures.empty()) {
+        if (!tilesetReady()) {
+            // Still decoding: show the background now, the map once tilesetArrived() redraws
+            glClearColor(0.1f, 0.1f, 0.1f, 1);
+            glClear(GL_COLOR_BUFFER_BIT);
+            return;
         }
+        TRACE_ZONE("tileset upload");
+        uploadTileset();
+    }
+    applyTilesetReloads();
+
+    chunkCache.releasePending();
+    pyramidPages.releasePending();
+    {
+        TRACE_ZONE("streaming");
+        updateStreaming();
+    }
+
+    glClearColor(0.1f, 0.1f, 0.1f, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // While panning at a constant zoom, most of the last frame is still correct: shift it
+    // into place and only draw the strips that scrolled into view
+    int shiftX = 0, shiftY = 0;
+    bool reuseFrame = scrollBlit && canReuseFrame(shiftX, shiftY);
+    if (reuseFrame)
+        drawPreviousFrame(shiftX, shiftY);
+
+    glPushMatrix();
+    glTranslatef(offsetX, offsetY, 0); // Apply panning
+    glScalef(zoom, zoom, 1.0f);        // Apply zoom scaling
+
+    if (reuseFrame) {
+        glEnable(GL_SCISSOR_TEST);
+        if (shiftX > 0) drawExposed(0, 0, shiftX, h());
+        if (shiftX < 0) drawExposed(w() + shiftX, 0, w(), h());
+        if (shiftY > 0) drawExposed(0, 0, w(), shiftY);
+        if (shiftY < 0) drawExposed(0, h() + shiftY, w(), h());
+        glDisable(GL_SCISSOR_TEST);
+    } else {
+        drawMap(0, 0, w(), h());
+    }
+
+    // Keep the map (but not the overlay) for the next frame
+    if (scrollBlit) {
+        TRACE_ZONE("scroll blit capture");
+        captureFrame();
     }
 
     // Draw an outline around the currently hovered tile
     if (hoveredX >= 0 && hoveredY >= 0) {
+        TRACE_ZONE("hover overlay");
         glDisable(GL_TEXTURE_2D);
         glColor3f(1.0, 0.0, 0.0);
         int tx = hoveredX * TILE_SIZE;
         int ty = hoveredY * TILE_SIZE;
+        countDraw(4);
         glBegin(GL_LINE_LOOP);
         glVertex2f(tx, ty);
         glVertex2f(tx + TILE_SIZE, ty);
@@ -205,18 +3634,33 @@ void TilemapWindow::draw() {
     }
 
     glPopMatrix();
+    size_t mapTiles = (size_t)tileMap.width() * tileMap.height();
+    frameWork.tilesCulled = mapTiles - std::min(mapTiles, frameWork.tilesDrawn);
+    lastFrameWork = frameWork;
+
+    TRACE_ZONE("hud");
+    if (hudVisible)
+        drawHud();
     glColor3f(1, 1, 1); // reset state
+    updateTitle();
+}
 
-    // FPS
-    frames++;
-    auto now = std::chrono::steady_clock::now();
-    float seconds = std::chrono::duration<float>(now - lastFpsTime).count();
-    if (seconds >= 1.0f) {
-        char title[128];
-        snprintf(title, sizeof(title), "Tilemap Viewer - FPS: %d", frames);
-        window()->label(title);
-        frames = 0;
-        lastFpsTime = now;
+void TilemapWindow::flush() {
+    // Time draw() plus the buffer swap; everything outside this is idle time. In a trace, the
+    // part of "frame" not covered by "draw" is the swap
+    TRACE_ZONE("frame");
+    auto start = std::chrono::steady_clock::now();
+    Fl_Gl_Window::flush();
+    double busy = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    busySinceReport += busy;
+    frameTimes.push((float)(busy * 1000.0));
+    framesRendered++;
+    framesSinceReport++;
+    if (!firstFrameShown && !pageTextures.empty()) {
+        // The first frame that shows the map, not the blank ones before the tileset arrived
+        firstFrameShown = true;
+        startupTimeline.mark("first_frame_swapped");
+        startupTimeline.finish();
     }
 }
 
@@ -225,21 +3669,98 @@ void TilemapWindow::updateHoveredTile(int mouseX, int mouseY) {
     float fy = (mouseY - offsetY) / zoom;
     int tileX = (int)(fx / TILE_SIZE);
     int tileY = (int)(fy / TILE_SIZE);
-    if (tileX >= 0 && tileY >= 0 && tileX < MAP_WIDTH && tileY < MAP_HEIGHT) {
+    int oldX = hoveredX, oldY = hoveredY;
+    if (tileX >= 0 && tileY >= 0 && tileX < tileMap.width() && tileY < tileMap.height()) {
         hoveredX = tileX;
         hoveredY = tileY;
     } else {
         hoveredX = hoveredY = -1;
     }
+    if (hoveredX != oldX || hoveredY != oldY)
+        redraw(); // Only the outline moved, but it still needs a new frame
+}
+
+void TilemapWindow::setTile(int x, int y, int tileIndex) {
+    if (x < 0 || y < 0 || x >= tileMap.width() || y >= tileMap.height())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(storageMutex);
+        int cx = x >> MAP_CHUNK_SHIFT, cy = y >> MAP_CHUNK_SHIFT;
+        if ((cx != editChunkX || cy != editChunkY) && editChunkX >= 0)
+            tileMap.settleChunk(editChunkX, editChunkY); // The previous chunk has gone cold
+        editChunkX = cx;
+        editChunkY = cy;
+        tileMap.set(x, y, tileIndex);
+    }
+    if (streamer)
+        streamer->patch(x, y, (TileId)tileIndex);
+    chunkCache.invalidateTile(x, y);
+    pyramid.update(x, y, [this](int x, int y) { return tileMap.get(x, y); });
+    pyramidPages.invalidateTile(x, y);
+    frameValid = colorMapValid = false;
+    redraw();
 }
 
 int TilemapWindow::handle(int event) {
+    TRACE_ZONE("handle");
     switch (event) {
+    case FL_FOCUS:
+    case FL_UNFOCUS:
+        return 1; // Accept keyboard focus
+    case FL_KEYDOWN:
+    case FL_SHORTCUT:
+        if (Fl::event_key() == 'r') {
+            // Cycle through the renderers for comparison
+            switch (renderMode) {
+            case RenderMode::VertexArray: renderMode = RenderMode::DisplayList; break;
+            case RenderMode::DisplayList: renderMode = RenderMode::Immediate;   break;
+            case RenderMode::Immediate:   renderMode = RenderMode::VertexArray; break;
+            }
+            frameValid = false;
+            redraw();
+            return 1;
+        }
+        if (Fl::event_key() == 'l') {
+            switch (farZoomMode) {
+            case FarZoomMode::Pyramid:  setFarZoomMode(FarZoomMode::ColorMap); break;
+            case FarZoomMode::ColorMap: setFarZoomMode(FarZoomMode::Skip);     break;
+            case FarZoomMode::Skip:     setFarZoomMode(FarZoomMode::Pyramid);  break;
+            }
+            return 1;
+        }
+        if (Fl::event_key() == 'c') {
+            setTileColor(tileColor == TileColor::Average ? TileColor::Dominant : TileColor::Average);
+            return 1;
+        }
+        if (Fl::event_key() == 's') {
+            setScrollBlit(!scrollBlit);
+            return 1;
+        }
+        if (Fl::event_key() == 'h') {
+            setHud(!hudVisible);
+            return 1;
+        }
+        if (Fl::event_key() == 't') {
+            writeTrace(tracePath);
+            return 1;
+        }
+        if (Fl::event_key() == 'b') {
+            setBenchmarkMode(!benchmarkMode);
+            return 1;
+        }
+        return 0;
     case FL_PUSH:
+        take_focus();
         if (Fl::event_button() == FL_LEFT_MOUSE) {
             dragging = true;
             lastMouseX = Fl::event_x();
             lastMouseY = Fl::event_y();
+            panVelocityX = panVelocityY = 0.0f;
+            lastDragTime = std::chrono::steady_clock::now();
+        } else if (Fl::event_button() == FL_RIGHT_MOUSE && hoveredX >= 0) {
+            // Minimal editing: cycle the hovered tile through the tileset
+            int cycle = std::min<int>(tileCount, TileStorage::maxTiles);
+            setTile(hoveredX, hoveredY, (tileMap.get(hoveredX, hoveredY) + 1) % std::max(1, cycle));
         }
         return 1;
     case FL_DRAG:
@@ -250,7 +3771,19 @@ int TilemapWindow::handle(int event) {
             offsetY += dy;
             lastMouseX = Fl::event_x();
             lastMouseY = Fl::event_y();
+
+            // Pan velocity for the streamer's prefetch, smoothed since drag events arrive unevenly
+            auto now = std::chrono::steady_clock::now();
+            double dt = std::chrono::duration<double>(now - lastDragTime).count();
+            lastDragTime = now;
+            if (dt > 0.0 && dt < PAN_IDLE_SECONDS) {
+                panVelocityX = 0.5f * panVelocityX + 0.5f * (float)(dx / dt);
+                panVelocityY = 0.5f * panVelocityY + 0.5f * (float)(dy / dt);
+            } else {
+                panVelocityX = panVelocityY = 0.0f;
+            }
             if (parentView) parentView->updateScrollbars();
+            redraw();
         }
         return 1;
     case FL_RELEASE:
@@ -266,6 +3799,8 @@ int TilemapWindow::handle(int event) {
         offsetX = mx - worldX * zoom;
         offsetY = my - worldY * zoom;
         if (parentView) parentView->updateScrollbars();
+        updateHoveredTile(mx, my);
+        redraw();
         return 1;
     }
     case FL_MOVE:
@@ -305,8 +3840,8 @@ TilemapScrollView::TilemapScrollView(int X, int Y, int W, int H)
 }
 
 void TilemapScrollView::updateScrollbars() {
-    int contentW = (int)(MAP_WIDTH * TILE_SIZE * canvas->zoom);
-    int contentH = (int)(MAP_HEIGHT * TILE_SIZE * canvas->zoom);
+    int contentW = (int)(canvas->mapWidth() * TILE_SIZE * canvas->zoom);
+    int contentH = (int)(canvas->mapHeight() * TILE_SIZE * canvas->zoom);
     int viewW = canvas->w();
     int viewH = canvas->h();
 
@@ -322,12 +3857,846 @@ void TilemapScrollView::resize(int X, int Y, int W, int H) {
     updateScrollbars();
 }
 
+// =============== Microbenchmarks ==================
+
+static volatile unsigned microbenchSink; // Results go here so the timed loops are not optimized away
+
+// Runs `pass` until MICROBENCH_SECONDS have gone by (at least once) and returns ns per unit of
+// work, where one pass does `units` units
+template <typename Pass>
+static double nsPerUnit(double units, Pass pass) {
+    auto start = std::chrono::steady_clock::now();
+    double ns = 0.0;
+    long passes = 0;
+    do {
+        pass();
+        ++passes;
+        ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    } while (ns < MICROBENCH_SECONDS * 1e9);
+    return ns / (passes * units);
+}
+
+// One result line: a label, then ns in the friendly order and (if measured) the unfriendly one
+static void printMicrobench(const char* label, double friendly, double unfriendly = -1.0, const char* unit = "") {
+    if (unfriendly < 0.0)
+        printf("%-32s %9.3f%s\n", label, friendly, unit);
+    else
+        printf("%-32s %9.3f  %12.3f%s\n", label, friendly, unfriendly, unit);
+}
+
+// Runs every quad kernel available on this machine over the same rows of random tiles and
+// reports ns per tile. Each kernel's output is checked against the scalar reference first.
+// Then times map initialisation and traversal, and the viewer's per-frame CPU work (visible
+// range, row traversal, vertex fill, hover hit test) over several map and viewport sizes,
+// where it applies in a cache-friendly order (row by row, as the viewer does it) and an
+// unfriendly one.
+int runMicrobenchmarks() {
+    const int rowLength = 4096;
+    const int rows = 64;
+    const int repeats = 20;
+    const int tileCount = TILES_PER_ROW * TILES_PER_ROW;
+
+    std::vector<TileId> tiles((size_t)rowLength * rows);
+    for (TileId& t : tiles)
+        t = (TileId)(rand() % tileCount);
+    std::vector<float> uvs((size_t)tileCount * 4);
+    for (int t = 0; t < tileCount; ++t) {
+        uvs[t * 4 + 0] = (t % TILES_PER_ROW) / (float)TILES_PER_ROW;
+        uvs[t * 4 + 1] = (t / TILES_PER_ROW) / (float)TILES_PER_ROW;
+        uvs[t * 4 + 2] = uvs[t * 4 + 0] + 1.0f / TILES_PER_ROW;
+        uvs[t * 4 + 3] = uvs[t * 4 + 1] + 1.0f / TILES_PER_ROW;
+    }
+
+    struct Candidate { QuadKernel kernel; const char* name; };
+    std::vector<Candidate> kernels = {{emitQuadsScalar, "scalar"}};
+#ifdef TILES_HAVE_SSE2
+    kernels.push_back({emitQuadsSse2, "sse2"});
+#endif
+#ifdef TILES_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back({emitQuadsAvx2, "avx2"});
+#endif
+
+    std::vector<TileVertex> reference((size_t)rowLength * 4), out((size_t)rowLength * 4);
+    int status = 0;
+    // Full rows, and short odd-length rows that exercise the kernels' tails
+    for (int count : {rowLength, 37}) {
+        emitQuadsScalar(reference.data(), tiles.data(), count, 32.0f, 48.0f, 16.0f, uvs.data());
+        for (const Candidate& c : kernels) {
+            c.kernel(out.data(), tiles.data(), count, 32.0f, 48.0f, 16.0f, uvs.data());
+            if (memcmp(out.data(), reference.data(), (size_t)count * 4 * sizeof(TileVertex)) != 0) {
+                printf("%-8s row %4d: output differs from scalar\n", c.name, count);
+                status = 1;
+                continue;
+            }
+
+            int passes = repeats * rowLength / count;
+            auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < passes; ++r)
+                for (int row = 0; row < rows; ++row)
+                    c.kernel(out.data(), &tiles[(size_t)row * rowLength], count,
+                             0.0f, row * 16.0f, 16.0f, uvs.data());
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            printf("%-8s row %4d: %6.3f ns/tile\n", c.name, count, ns / ((double)passes * rows * count));
+        }
+    }
+
+    // Map initialisation. A generated map only records its generator, so what is timed is the
+    // first touch of each chunk, which computes all its tiles; the LOD pyramid reads every tile
+    // once. Filling a map with set() allocates chunks, in map order or across them.
+    MapGenerator generator{1, (unsigned)tileCount};
+    auto tileAt = [&generator](int x, int y) { return generator.tile(x, y); };
+    printf("\n%-32s %9s  %12s (ns/tile)\n", "map init", "friendly", "unfriendly");
+    for (int size : {1024, 4096, MAP_WIDTH}) {
+        double tilesInMap = (double)size * size;
+        double generate = nsPerUnit(tilesInMap, [&] {
+            TileStorage map(size, size);
+            map.generate(tileAt);
+            unsigned sum = 0;
+            for (int y = 0; y < size; y += MAP_CHUNK_SIZE)
+                for (int x = 0; x < size; x += MAP_CHUNK_SIZE)
+                    sum += map.get(x, y);
+            microbenchSink += sum;
+        });
+        double pyramid = nsPerUnit(tilesInMap, [&] {
+            LodPyramid p;
+            p.build(size, size, tileAt, nullptr);
+            microbenchSink += p.levelCount();
+        });
+        char label[64];
+        snprintf(label, sizeof(label), "%dx%d first-touch generate", size, size);
+        printMicrobench(label, generate);
+        snprintf(label, sizeof(label), "%dx%d pyramid", size, size);
+        printMicrobench(label, pyramid);
+        if (size > 4096)
+            continue; // Tile-by-tile fills of the full map take too long to repeat
+        double rowMajor = nsPerUnit(tilesInMap, [&] {
+            TileStorage map(size, size);
+            for (int y = 0; y < size; ++y)
+                for (int x = 0; x < size; ++x)
+                    map.set(x, y, generator.tile(x, y));
+            microbenchSink += map.get(size / 2, size / 2);
+        });
+        double columnMajor = nsPerUnit(tilesInMap, [&] {
+            TileStorage map(size, size);
+            for (int x = 0; x < size; ++x)
+                for (int y = 0; y < size; ++y)
+                    map.set(x, y, generator.tile(x, y));
+            microbenchSink += map.get(size / 2, size / 2);
+        });
+        snprintf(label, sizeof(label), "%dx%d set() fill", size, size);
+        printMicrobench(label, rowMajor, columnMajor);
+    }
+
+    // Map traversal, one get() per tile either way: in map order, and in a stride that jumps
+    // across the whole map, so once the map outgrows the last-level cache nearly every call
+    // misses it. Walk i reads tile (i * stride) mod n in map order, which visits every tile
+    // once for any stride coprime to n; both orders run the same instructions.
+    printf("\n%-32s %9s  %12s (ns/tile)\n", "map traversal", "friendly", "unfriendly");
+    for (int size : {1024, 4096, MAP_WIDTH}) {
+        TileStorage map(size, size);
+        for (int y = 0; y < size; ++y)
+            for (int x = 0; x < size; ++x)
+                map.set(x, y, generator.tile(x, y));
+        uint64_t tilesInMap = (uint64_t)size * size;
+        uint64_t jump = (uint64_t)(tilesInMap * 0.6180339887) | 1; // Map sizes only have factors 2 and 5
+        while (jump % 5 == 0)
+            jump += 2;
+        volatile uint64_t strides[2] = {1, jump}; // Read at run time, so neither walk is specialised
+        auto walk = [&](int order) {
+            uint64_t stride = strides[order];
+            unsigned sum = 0;
+            for (uint64_t i = 0, j = 0; i < tilesInMap; ++i) {
+                sum += map.get((int)(j % size), (int)(j / size));
+                j += stride;
+                if (j >= tilesInMap)
+                    j -= tilesInMap;
+            }
+            microbenchSink += sum;
+        };
+        double inOrder = nsPerUnit((double)tilesInMap, [&] { walk(0); });
+        double strided = nsPerUnit((double)tilesInMap, [&] { walk(1); });
+        char label[64];
+        snprintf(label, sizeof(label), "%dx%d get(), %.1f MB", size, size, map.memoryBytes() / 1048576.0);
+        printMicrobench(label, inOrder, strided);
+    }
+
+    // Per-frame work of the viewer, on stored maps small enough to stay in cache and too large
+    // to. The window is never shown; nothing here touches GL.
+    TilemapWindow window(0, 0, 800, 600);
+    window.uvTable = uvs; // Without a GL context no tileset is uploaded; the kernels' UVs do
+    const int viewports[][2] = {{800, 600}, {1920, 1080}, {3840, 2160}};
+    for (int size : {1024, 4096}) {
+        PreparedMap map;
+        map.tiles = TileStorage(size, size);
+        for (int y = 0; y < size; ++y)
+            for (int x = 0; x < size; ++x)
+                map.tiles.set(x, y, generator.tile(x, y));
+        window.installMap(std::move(map));
+
+        for (const auto& viewport : viewports) {
+            int viewW = viewport[0], viewH = viewport[1];
+            char title[64];
+            snprintf(title, sizeof(title), "map %dx%d, view %dx%d", size, size, viewW, viewH);
+            printf("\n%-32s %9s  %12s (ns/tile)\n", title, "friendly", "unfriendly");
+
+            // Visible range: constant work per call, so per call rather than per tile
+            window.offsetX = window.offsetY = 0.0f;
+            window.zoom = 1.0f;
+            int pans = 0;
+            double range = nsPerUnit(1024, [&] {
+                for (int i = 0; i < 1024; ++i, ++pans) {
+                    window.offsetX = -(float)(pans & 4095);
+                    ViewRange view = window.visibleRange(0, 0, viewW, viewH);
+                    microbenchSink += view.tileX1;
+                }
+            });
+            printMicrobench("visible range", range, -1.0, " ns/call");
+            window.offsetX = 0.0f;
+
+            // Traversal of the visible range at each sampling step, zoomed out just far enough
+            // for it, in rows as drawn (the view's tiles fit in cache, so there is no unfriendly
+            // order worth timing here; see "map traversal" for that)
+            std::vector<TileId> row;
+            for (int step : {1, 2, 4, 8, 16}) {
+                window.zoom = MIN_VISIBLE_PIXELS / ((float)TILE_SIZE * step) * 1.0001f;
+                ViewRange view = window.visibleRange(0, 0, viewW, viewH);
+                int cols = (view.tileX1 - view.tileX0 + step - 1) / step;
+                int sampledRows = (view.tileY1 - view.tileY0 + step - 1) / step;
+                double sampled = (double)cols * sampledRows;
+                row.resize(cols);
+                double rowMajor = nsPerUnit(sampled, [&] {
+                    unsigned sum = 0;
+                    for (int r = 0; r < sampledRows; ++r) {
+                        window.readRow(view.tileY0 + r * step, view.tileX0, cols, step, row.data());
+                        for (TileId t : row)
+                            sum += t;
+                    }
+                    microbenchSink += sum;
+                });
+                char label[64];
+                snprintf(label, sizeof(label), "traverse step %d, %.0f tiles", step, sampled);
+                printMicrobench(label, rowMajor);
+            }
+
+            // Vertex fill as drawn with vertex arrays: fillTileRows() reading each row and
+            // emitting its quads with the selected kernel through uvTable, at the most tiles
+            // drawn one by one (step 1, 4 pixels a tile)
+            window.zoom = MIN_VISIBLE_PIXELS / TILE_SIZE * 1.0001f;
+            ViewRange view = window.visibleRange(0, 0, viewW, viewH);
+            size_t visible = (size_t)(view.tileX1 - view.tileX0) * (view.tileY1 - view.tileY0);
+            std::vector<TileVertex> quads(visible * 4);
+            double fill = nsPerUnit((double)visible, [&] {
+                window.fillTileRows(quads.data(), nullptr, view.tileX0, view.tileX1, view.tileY0, view.tileY1, 1);
+                microbenchSink += (unsigned)quads[visible * 2].x;
+            });
+            char label[64];
+            snprintf(label, sizeof(label), "fill rows (%s), %zu tiles", quadKernelName(window.quadKernel), visible);
+            printMicrobench(label, fill);
+
+            // Hover hit test at 1x: the mouse moving along rows of pixels, against random jumps
+            window.zoom = 1.0f;
+            window.offsetX = window.offsetY = 0.0f;
+            size_t pixels = (size_t)viewW * viewH;
+            const size_t moves = 1 << 16;
+            std::vector<uint32_t> jumps(moves);
+            for (uint32_t& p : jumps)
+                p = (uint32_t)(((size_t)rand() << 16 ^ (size_t)rand()) % pixels);
+            int mouseX = 0, mouseY = 0;
+            double hoverSweep = nsPerUnit((double)moves, [&] {
+                for (size_t i = 0; i < moves; ++i) {
+                    window.updateHoveredTile(mouseX, mouseY);
+                    if (++mouseX == viewW) {
+                        mouseX = 0;
+                        mouseY = mouseY + 1 == viewH ? 0 : mouseY + 1;
+                    }
+                }
+            });
+            double hoverJump = nsPerUnit((double)moves, [&] {
+                for (uint32_t p : jumps)
+                    window.updateHoveredTile((int)(p % viewW), (int)(p / viewW));
+            });
+            printMicrobench("hover", hoverSweep, hoverJump, " ns/call");
+        }
+    }
+    return status;
+}
+
+// =============== Self Tests ==================
+
+// Writes a map with uniform, sparse and fully random chunks (and ragged edges), maps it back
+// and compares every tile and pyramid block. Also checks that editing the mapped copy leaves
+// the file untouched.
+int runMapRoundTripTest() {
+    const char* path = "fltiles-roundtrip.fltmap";
+    const int width = 5 * MAP_CHUNK_SIZE + 17, height = 3 * MAP_CHUNK_SIZE + 5;
+    const int tileCount = TILES_PER_ROW * TILES_PER_ROW;
+
+    TileStorage map(width, height, 7);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            if (x >= 2 * MAP_CHUNK_SIZE || (y < MAP_CHUNK_SIZE && (x + y) % 97 == 0))
+                map.set(x, y, rand() % tileCount);
+    map.compact();
+    LodPyramid pyramid;
+    pyramid.build(width, height, [&](int x, int y) { return map.get(x, y); });
+
+    auto fail = [&](const char* what) {
+        printf("map round trip: %s\n", what);
+        remove(path);
+        return 1;
+    };
+    auto sameTiles = [&](const TileStorage& a, const TileStorage& b) {
+        std::vector<TileId> rowA(width), rowB(width);
+        for (int y = 0; y < height; ++y) {
+            a.decodeRow(y, 0, width, 1, rowA.data());
+            b.decodeRow(y, 0, width, 1, rowB.data());
+            if (rowA != rowB)
+                return false;
+            for (int x = 0; x < width; x += 13)
+                if (a.get(x, y) != b.get(x, y))
+                    return false;
+        }
+        return true;
+    };
+
+    size_t packedChunks = 0;
+    if (!writeMapFile(path, map, pyramid))
+        return fail("write failed");
+    {
+        std::unique_ptr<MapFile> file = MapFile::open(path);
+        TileStorage loaded(0, 0);
+        LodPyramid loadedPyramid;
+        if (!file || !loadMapFile(*file, loaded, loadedPyramid))
+            return fail("load failed");
+        if (loaded.width() != width || loaded.height() != height || !sameTiles(map, loaded))
+            return fail("tiles differ");
+        if (loaded.allocatedChunks() != 0 || loaded.mappedChunks() != map.allocatedChunks())
+            return fail("chunks were copied instead of mapped");
+        if (loaded.compressedChunks() == 0 || loaded.compressedChunks() == loaded.mappedChunks())
+            return fail("expected both compressed and plain chunk payloads");
+        packedChunks = loaded.compressedChunks();
+        if (loadedPyramid.levelCount() != pyramid.levelCount())
+            return fail("pyramid depth differs");
+        for (int level = 1; level < pyramid.levelCount(); ++level)
+            if (memcmp(loadedPyramid.levelData(level), pyramid.levelData(level),
+                       (size_t)pyramid.levelWidth(level) * pyramid.levelHeight(level)) != 0)
+                return fail("pyramid differs");
+
+        // Edit both a mapped and a uniform chunk of the loaded copy
+        loaded.set(width - 1, 0, (loaded.get(width - 1, 0) + 1) % tileCount);
+        loaded.set(1, 1, (loaded.get(1, 1) + 1) % tileCount);
+    }
+    {
+        std::unique_ptr<MapFile> file = MapFile::open(path);
+        TileStorage reloaded(0, 0);
+        LodPyramid reloadedPyramid;
+        if (!file || !loadMapFile(*file, reloaded, reloadedPyramid) || !sameTiles(map, reloaded))
+            return fail("edits leaked into the file");
+    }
+    {
+        // A wrong chunk grid, or tile IDs out of range in the directory or the pyramid, must be
+        // rejected (the mapping is private, so the damage never reaches the file)
+        auto rejects = [&](void (*damage)(MapFile&)) {
+            std::unique_ptr<MapFile> file = MapFile::open(path);
+            TileStorage damaged(0, 0);
+            LodPyramid damagedPyramid;
+            if (!file)
+                return false;
+            damage(*file);
+            return !loadMapFile(*file, damaged, damagedPyramid);
+        };
+        if (!rejects([](MapFile& f) { reinterpret_cast<MapFileHeader*>(f.at(0))->chunksX += 100; }))
+            return fail("accepted a chunk grid larger than the map");
+        if (!rejects([](MapFile& f) { reinterpret_cast<MapFileHeader*>(f.at(0))->chunkBytes = 8; }))
+            return fail("accepted a chunk payload size the writer never uses");
+        if (!rejects([](MapFile& f) {
+                const MapFileHeader& h = f.header();
+                auto* e = reinterpret_cast<MapChunkEntry*>(f.at(h.directoryOffset));
+                while (!e->offset)
+                    ++e;
+                e->offset = UINT64_MAX - 7; // Wraps around when the payload size is added
+            }))
+            return fail("accepted a chunk payload past the end of the file");
+
+        // Compressed payloads are only decoded when read; a damaged one reads as tile 0
+        std::unique_ptr<MapFile> file = MapFile::open(path);
+        TileStorage damaged(0, 0);
+        LodPyramid damagedPyramid;
+        if (!file || !loadMapFile(*file, damaged, damagedPyramid))
+            return fail("load failed");
+        const MapFileHeader& h = file->header();
+        auto* e = reinterpret_cast<MapChunkEntry*>(file->at(h.directoryOffset));
+        size_t index = 0;
+        while (!e[index].packedBytes)
+            ++index;
+        memset(file->at(e[index].offset), 0xFF, e[index].packedBytes);
+        int x = (int)(index % h.chunksX) * MAP_CHUNK_SIZE, y = (int)(index / h.chunksX) * MAP_CHUNK_SIZE;
+        if (damaged.get(x, y) != 0)
+            return fail("a damaged compressed chunk did not read as tile 0");
+        if (!rejects([](MapFile& f) {
+                const MapFileHeader& h = f.header();
+                auto* e = reinterpret_cast<MapChunkEntry*>(f.at(h.directoryOffset));
+                while (e->offset)
+                    ++e;
+                e->uniform = TileStorage::maxTiles;
+            }))
+            return fail("accepted an out-of-range uniform tile");
+        if (TileStorage::maxTiles <= 0xFF &&
+            !rejects([](MapFile& f) { f.at(f.header().pyramidOffset)[1] = (uint8_t)TileStorage::maxTiles; }))
+            return fail("accepted an out-of-range pyramid tile");
+    }
+    remove(path);
+    printf("map round trip: ok (%dx%d, %zu of %d chunks stored, %zu compressed)\n", width, height,
+           map.allocatedChunks(), map.chunkColumns() * map.chunkRows(), packedChunks);
+    return 0;
+}
+
+// Fills a map with long runs, vertical stripes, scattered tiles and pure noise, compresses it
+// and reads every tile back through get() and decodeRow() (from several threads at once, with
+// far more chunks than the hot cache holds). Also checks that editing a compressed chunk works.
+int runCompressionTest() {
+    const int width = 40 * MAP_CHUNK_SIZE + 9, height = 24 * MAP_CHUNK_SIZE + 3;
+    const int tileCount = TILES_PER_ROW * TILES_PER_ROW;
+
+    std::vector<TileId> reference((size_t)width * height);
+    TileStorage map(width, height);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int tile;
+            if (x < width / 2)
+                tile = (x / 37 + y / 23) % tileCount;              // Runs
+            else if (y < height / 2)
+                tile = (x % 5 == 0 ? 3 : 9) + (y / 64) % 2;        // Vertical stripes
+            else if (x < width * 3 / 4)
+                tile = rand() % 97 == 0 ? rand() % tileCount : 5;  // Mostly one tile
+            else
+                tile = rand() % tileCount;                         // Noise
+            reference[(size_t)y * width + x] = (TileId)tile;
+            map.set(x, y, tile);
+        }
+    }
+    map.compact();
+    size_t plainBytes = map.memoryBytes();
+    map.compress();
+    size_t compressedBytes = map.memoryBytes();
+    size_t compressed = map.compressedChunks();
+
+    auto fail = [](const char* what) {
+        printf("compression: %s\n", what);
+        return 1;
+    };
+    if (compressed == 0 || map.allocatedChunks() == 0)
+        return fail("expected both compressed and plain chunks");
+
+    std::atomic<int> mismatches{0};
+    auto checkRows = [&](int first, int step) {
+        std::vector<TileId> row(width);
+        for (int y = first; y < height; y += step) {
+            for (int stride : {1, 3}) {
+                int count = (width + stride - 1) / stride;
+                map.decodeRow(y, 0, count, stride, row.data());
+                for (int i = 0; i < count; ++i)
+                    if (row[i] != reference[(size_t)y * width + i * stride])
+                        mismatches++;
+            }
+            for (int x = y % 7; x < width; x += 7)
+                if (map.get(x, y) != reference[(size_t)y * width + x])
+                    mismatches++;
+        }
+    };
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t)
+        readers.emplace_back(checkRows, t, 4);
+    for (std::thread& t : readers)
+        t.join();
+    if (mismatches)
+        return fail("tiles differ after compression");
+
+    // Edit a compressed chunk: it goes back to plain form and keeps its other tiles
+    int x = 10, y = 10;
+    map.set(x, y, (reference[(size_t)y * width + x] + 1) % tileCount);
+    reference[(size_t)y * width + x] = (TileId)((reference[(size_t)y * width + x] + 1) % tileCount);
+    if (map.compressedChunks() != compressed - 1)
+        return fail("edited chunk is still compressed");
+    checkRows(0, 1);
+    if (mismatches)
+        return fail("tiles differ after an edit");
+
+    // Once edits move on, the chunk is compressed again
+    map.settleChunk(x >> MAP_CHUNK_SHIFT, y >> MAP_CHUNK_SHIFT);
+    if (map.compressedChunks() != compressed)
+        return fail("settled chunk was not compressed again");
+    checkRows(0, 1);
+    if (mismatches)
+        return fail("tiles differ after settling an edited chunk");
+
+    unsigned long long hits, misses;
+    map.hotStats(hits, misses);
+    printf("compression: ok (%zu of %d chunks compressed; %.2f MB plain, %.2f MB compressed, %.2f MB as int; "
+           "hot cache %llu hits, %llu misses)\n",
+           compressed, map.chunkColumns() * map.chunkRows(), plainBytes / 1048576.0, compressedBytes / 1048576.0,
+           (double)width * height * sizeof(int) / 1048576.0, hits, misses);
+    return 0;
+}
+
+// =============== Benchmark Paths ==================
+
+// Camera for one frame of a scripted path
+struct CameraPose {
+    float offsetX, offsetY, zoom;
+    int hoverX = -1, hoverY = -1; // Mouse position in the window, or -1 to leave the hover alone
+};
+
+struct CameraPath {
+    const char* name;
+    int frames;
+    CameraPose (*pose)(int frame, int frames, int viewW, int viewH, float mapW, float mapH);
+};
+
+// Map centre in the middle of the view at `zoom`, moved by (dx, dy) screen pixels
+static CameraPose centredPose(float zoom, float dx, float dy, int viewW, int viewH, float mapW, float mapH) {
+    return CameraPose{viewW * 0.5f - mapW * 0.5f * zoom - dx, viewH * 0.5f - mapH * 0.5f * zoom - dy, zoom};
+}
+
+static const CameraPath cameraPaths[] = {
+    // Steady drag of a couple of pixels a frame: nearly all of each frame was on screen before
+    {"slow-pan", 600, [](int f, int, int w, int h, float mw, float mh) {
+        return centredPose(1.0f, 2.0f * f, 1.0f * f, w, h, mw, mh);
+    }},
+    // A fling starting at 400 pixels a frame and slowing down, crossing a new chunk every few frames
+    {"fling", 300, [](int f, int, int w, int h, float mw, float mh) {
+        float d = 400.0f * (1.0f - std::pow(0.98f, (float)f)) / 0.02f;
+        return centredPose(1.0f, d, d * 0.5f, w, h, mw, mh);
+    }},
+    // Exponential zoom from 8x to 0.01x about the centre, through every far-zoom level
+    {"zoom-out", 600, [](int f, int n, int w, int h, float mw, float mh) {
+        return centredPose(8.0f * std::pow(0.01f / 8.0f, (float)f / (n - 1)), 0.0f, 0.0f, w, h, mw, mh);
+    }},
+    // The mouse sweeping across the view row by row at 1x, moving the hover outline every frame
+    {"hover-sweep", 600, [](int f, int, int w, int h, float mw, float mh) {
+        CameraPose pose = centredPose(1.0f, 0.0f, 0.0f, w, h, mw, mh);
+        int perRow = std::max(1, w / TILE_SIZE);
+        pose.hoverX = (f % perRow) * TILE_SIZE + TILE_SIZE / 2;
+        pose.hoverY = ((f / perRow) * 3 * TILE_SIZE) % std::max(1, h) + TILE_SIZE / 2;
+        return pose;
+    }},
+};
+
+// Replays camera paths through the normal draw and swap, one frame per step, and writes every
+// frame's time as JSON. Meant to run under Xvfb with a software renderer (llvmpipe) on CI.
+static int runBenchmarkPaths(TilemapWindow& canvas, const char* which, const char* jsonPath,
+                             const char* renderer, const char* farZoom, int threads) {
+    bool all = !strcmp(which, "all");
+    bool known = all;
+    for (const CameraPath& path : cameraPaths)
+        known = known || !strcmp(which, path.name);
+    if (!known) {
+        fprintf(stderr, "error: unknown benchmark path '%s'\n", which);
+        return 1;
+    }
+
+    // The tileset decode, texture upload and first frame are not part of any path
+    while (!canvas.mapShown()) {
+        if (!Fl::first_window())
+            return 1;
+        Fl::wait(0.01);
+    }
+
+    FILE* f = strcmp(jsonPath, "-") ? fopen(jsonPath, "w") : stdout;
+    if (!f) {
+        fprintf(stderr, "error: cannot write '%s': %s\n", jsonPath, strerror(errno));
+        return 1;
+    }
+    fprintf(f, "{\"renderer\": \"%s\", \"far_zoom\": \"%s\", \"threads\": %d, \"width\": %d, \"height\": %d, \"paths\": [",
+            renderer, farZoom, threads, canvas.w(), canvas.h());
+    float mapW = (float)canvas.mapWidth() * TILE_SIZE, mapH = (float)canvas.mapHeight() * TILE_SIZE;
+    bool first = true;
+    for (const CameraPath& path : cameraPaths) {
+        if (!all && strcmp(which, path.name))
+            continue;
+        std::vector<double> frameMs(path.frames);
+        std::vector<RenderStats> work(path.frames);
+        for (int i = 0; i < path.frames; ++i) {
+            Fl::check(); // Streamed chunks and other main-thread work, outside the timed frame
+            CameraPose pose = path.pose(i, path.frames, canvas.w(), canvas.h(), mapW, mapH);
+            canvas.setCamera(pose.offsetX, pose.offsetY, pose.zoom);
+            if (pose.hoverX >= 0)
+                canvas.updateHoveredTile(pose.hoverX, pose.hoverY);
+            auto start = std::chrono::steady_clock::now();
+            Fl::flush();
+            canvas.make_current();
+            glFinish(); // Count the rendering itself, not just its submission
+            frameMs[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            work[i] = canvas.renderStats();
+        }
+
+        std::vector<double> sorted = frameMs;
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&](double p) { return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))]; };
+        double total = 0.0;
+        for (double ms : frameMs)
+            total += ms;
+        fprintf(stderr, "%-12s %4d frames: mean %.2f ms, p50 %.2f, p95 %.2f, p99 %.2f, max %.2f\n", path.name,
+                path.frames, total / path.frames, percentile(0.5), percentile(0.95), percentile(0.99), sorted.back());
+        fprintf(f, "%s\n  {\"name\": \"%s\", \"frames\": %d, \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p95_ms\": %.3f, "
+                   "\"p99_ms\": %.3f, \"max_ms\": %.3f, \"frame_ms\": [",
+                first ? "" : ",", path.name, path.frames, total / path.frames, percentile(0.5), percentile(0.95),
+                percentile(0.99), sorted.back());
+        for (int i = 0; i < path.frames; ++i)
+            fprintf(f, "%s%.3f", i ? ", " : "", frameMs[i]);
+        // The GL work of each frame, index for index with frame_ms
+        auto counts = [&](const char* name, size_t (*field)(const RenderStats&)) {
+            fprintf(f, "], \"%s\": [", name);
+            for (int i = 0; i < path.frames; ++i)
+                fprintf(f, "%s%zu", i ? ", " : "", field(work[i]));
+        };
+        counts("draw_calls", [](const RenderStats& s) { return s.drawCalls; });
+        counts("vertices", [](const RenderStats& s) { return s.vertices; });
+        counts("texture_binds", [](const RenderStats& s) { return s.textureBinds; });
+        counts("tiles_drawn", [](const RenderStats& s) { return s.tilesDrawn; });
+        counts("tiles_culled", [](const RenderStats& s) { return s.tilesCulled; });
+        counts("lod_step", [](const RenderStats& s) { return (size_t)s.lodStep; });
+        counts("bytes_uploaded", [](const RenderStats& s) { return s.bytesUploaded; });
+        fprintf(f, "]}");
+        first = false;
+    }
+    fprintf(f, "\n]}\n");
+    if (f != stdout)
+        fclose(f);
+    return 0;
+}
+
 // =============== Main ==================
 
+// Command-line options, parsed ahead of FLTK's own options
+struct Options {
+    RenderMode renderMode = RenderMode::VertexArray;
+    size_t chunkBudget = DEFAULT_CHUNK_BUDGET;
+    bool benchmark = false;
+    bool scrollBlit = false;
+    int threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    KernelChoice kernel = KernelChoice::Auto;
+    bool microbench = false;
+    bool roundTripTest = false;
+    bool compressionTest = false;
+    const char* mapPath = nullptr;
+    const char* writeMapPath = nullptr;
+    int streaming = -1; // -1: only for maps opened from a file
+    uint64_t seed = 1;
+    const char* startupJson = nullptr;
+    bool tilesetCache = true;
+    std::vector<std::string> tilesets; // tileset.png when none are given
+    int atlasPageSize = 0;
+    FarZoomMode farZoom = FarZoomMode::Pyramid;
+    TileColor tileColor = TileColor::Average;
+    bool hud = true;
+    const char* benchPath = nullptr;
+    const char* benchJson = "-";
+    const char* tracePath = "tiles-trace.json";
+};
+
+static Options options;
+
+static const char* usage =
+    "  --renderer immediate|arrays|lists\n"
+    "  --chunk-budget N   display lists kept by the chunk cache\n"
+    "  --benchmark        redraw continuously instead of on demand\n"
+    "  --scroll-blit      reuse the previous frame while panning\n"
+    "  --no-hud           start with the frame statistics overlay hidden\n"
+    "  --far-zoom pyramid|colormap|skip  renderer for tiles under 4 pixels\n"
+    "  --tile-colors average|dominant    colour of a tile drawn as one texel\n"
+    "  --threads N        threads generating vertices (default: all cores)\n"
+    "  --kernel auto|scalar|sse2|avx2\n"
+    "  --microbench       time the quad kernels, map setup and traversal and per-frame CPU work, then exit\n"
+    "  --bench-path NAME  replay a camera path (slow-pan, fling, zoom-out, hover-sweep or all), then exit\n"
+    "  --bench-json FILE  where --bench-path writes its frame times (default: stdout)\n"
+    "  --trace FILE       where T and exit write the trace (default tiles-trace.json; needs -DTILES_TRACE)\n"
+    "  --map FILE         open a .fltmap map instead of generating one\n"
+    "  --seed N           seed of the generated map (default 1)\n"
+    "  --write-map FILE   write the map to a .fltmap file and exit\n"
+    "  --streaming on|off decode chunks on a background thread (default: on for --map)\n"
+    "  --tileset FILE     add a tileset image (repeatable; default tileset.png)\n"
+    "  --atlas-page-size N  cap atlas textures at N pixels, at least 32 (default GL_MAX_TEXTURE_SIZE)\n"
+    "  --no-tileset-cache always decode tileset images instead of mapping their .rgba cache\n"
+    "  --startup-json FILE  write time-to-first-frame phases as JSON (- for stdout)\n"
+    "  --roundtrip-test   check that maps survive writing and mapping back, then exit\n"
+    "  --compression-test check that compressed chunks read back intact, then exit\n";
+
+// Fl_Args_Handler: consume our options and advance i, or return 0 to let FLTK try
+static int parseOption(int argc, char** argv, int& i) {
+    const char* arg = argv[i];
+    if (!strcmp(arg, "--benchmark")) {
+        options.benchmark = true;
+        i += 1;
+        return 1;
+    }
+    if (!strcmp(arg, "--scroll-blit")) {
+        options.scrollBlit = true;
+        i += 1;
+        return 1;
+    }
+    if (!strcmp(arg, "--no-hud")) {
+        options.hud = false;
+        i += 1;
+        return 1;
+    }
+    if (!strcmp(arg, "--no-tileset-cache")) {
+        options.tilesetCache = false;
+        i += 1;
+        return 1;
+    }
+    if (!strcmp(arg, "--microbench")) {
+        options.microbench = true;
+        i += 1;
+        return 1;
+    }
+    if (!strcmp(arg, "--roundtrip-test")) {
+        options.roundTripTest = true;
+        i += 1;
+        return 1;
+    }
+    if (!strcmp(arg, "--compression-test")) {
+        options.compressionTest = true;
+        i += 1;
+        return 1;
+    }
+    if (i + 1 >= argc)
+        return 0;
+    const char* value = argv[i + 1];
+
+    if (!strcmp(arg, "--renderer")) {
+        if (!strcmp(value, "immediate"))   options.renderMode = RenderMode::Immediate;
+        else if (!strcmp(value, "arrays")) options.renderMode = RenderMode::VertexArray;
+        else if (!strcmp(value, "lists"))  options.renderMode = RenderMode::DisplayList;
+        else return 0;
+    } else if (!strcmp(arg, "--far-zoom")) {
+        if (!strcmp(value, "pyramid"))       options.farZoom = FarZoomMode::Pyramid;
+        else if (!strcmp(value, "colormap")) options.farZoom = FarZoomMode::ColorMap;
+        else if (!strcmp(value, "skip"))     options.farZoom = FarZoomMode::Skip;
+        else return 0;
+    } else if (!strcmp(arg, "--tile-colors")) {
+        if (!strcmp(value, "average"))       options.tileColor = TileColor::Average;
+        else if (!strcmp(value, "dominant")) options.tileColor = TileColor::Dominant;
+        else return 0;
+    } else if (!strcmp(arg, "--chunk-budget")) {
+        options.chunkBudget = (size_t)std::max(1, atoi(value));
+    } else if (!strcmp(arg, "--map")) {
+        options.mapPath = value;
+    } else if (!strcmp(arg, "--tileset")) {
+        options.tilesets.push_back(value);
+    } else if (!strcmp(arg, "--atlas-page-size")) {
+        options.atlasPageSize = std::max(ATLAS_CELL, atoi(value)); // One tile with its gutter
+    } else if (!strcmp(arg, "--bench-path")) {
+        options.benchPath = value;
+    } else if (!strcmp(arg, "--bench-json")) {
+        options.benchJson = value;
+    } else if (!strcmp(arg, "--trace")) {
+        options.tracePath = value;
+    } else if (!strcmp(arg, "--startup-json")) {
+        options.startupJson = value;
+    } else if (!strcmp(arg, "--seed")) {
+        options.seed = strtoull(value, nullptr, 10);
+    } else if (!strcmp(arg, "--write-map")) {
+        options.writeMapPath = value;
+    } else if (!strcmp(arg, "--streaming")) {
+        if (!strcmp(value, "on"))       options.streaming = 1;
+        else if (!strcmp(value, "off")) options.streaming = 0;
+        else return 0;
+    } else if (!strcmp(arg, "--threads")) {
+        options.threads = std::max(1, atoi(value));
+    } else if (!strcmp(arg, "--kernel")) {
+        if (!strcmp(value, "auto"))        options.kernel = KernelChoice::Auto;
+        else if (!strcmp(value, "scalar")) options.kernel = KernelChoice::Scalar;
+        else if (!strcmp(value, "sse2"))   options.kernel = KernelChoice::Sse2;
+        else if (!strcmp(value, "avx2"))   options.kernel = KernelChoice::Avx2;
+        else return 0;
+    } else {
+        return 0;
+    }
+    i += 2;
+    return 2;
+}
+
 int main(int argc, char** argv) {
+    int i = 0;
+    if (Fl::args(argc, argv, i, parseOption) < argc) {
+        fprintf(stderr, "error: bad option '%s'\nusage: %s [options]\n%s%s", argv[i], argv[0], usage, Fl::help);
+        return 1;
+    }
+    if (options.microbench) {
+        logStream = stderr; // The result table alone goes to stdout
+        return runMicrobenchmarks();
+    }
+    if (options.roundTripTest)
+        return runMapRoundTripTest();
+    if (options.compressionTest)
+        return runCompressionTest();
+
+    if (options.writeMapPath) {
+        PreparedMap map;
+        ThreadPool pool(options.threads - 1);
+        bool ok = true;
+        if (options.mapPath)
+            ok = prepareMapFile(options.mapPath, map);
+        else
+            prepareGeneratedMap(options.seed, &pool, map);
+        return ok && writeMapFile(options.writeMapPath, map.tiles, map.pyramid) ? 0 : 1;
+    }
+    startupTimeline.setJsonPath(options.startupJson);
+    if ((options.benchPath && !strcmp(options.benchJson, "-")) || (options.startupJson && !strcmp(options.startupJson, "-")))
+        logStream = stderr; // Keep stdout parseable
+    TRACE_THREAD("main");
+
+    // Startup pipeline: the tileset decode and the map run on their own threads while the
+    // window is created and shown; draw() shows the map as soon as both have arrived
+    Fl::lock(); // Enables Fl::awake, which the tileset decode and the streamer use to reach the main thread
     Fl_Window win(800, 600, "Tilemap Viewer");
     TilemapScrollView viewer(0, 0, 800, 600);
+    if (options.tilesets.empty())
+        options.tilesets.push_back("tileset.png");
+    viewer.canvas->setAtlasPageLimit(options.atlasPageSize);
+    viewer.canvas->loadTilesetAsync(options.tilesets, options.tilesetCache);
+    viewer.canvas->watchTileset();
+    viewer.canvas->renderMode = options.renderMode;
+    viewer.canvas->setChunkBudget(options.chunkBudget);
+    viewer.canvas->setBenchmarkMode(options.benchmark);
+    viewer.canvas->setScrollBlit(options.scrollBlit);
+    viewer.canvas->setHud(options.hud);
+    viewer.canvas->setTracePath(options.tracePath);
+    viewer.canvas->setFarZoomMode(options.farZoom);
+    viewer.canvas->setTileColor(options.tileColor);
+    viewer.canvas->setWorkerThreads(options.threads);
+    viewer.canvas->setQuadKernel(options.kernel);
+
+    PreparedMap map;
+    ThreadPool* pool = viewer.canvas->workers(); // Idle until the first frame
+    std::future<bool> mapReady = std::async(std::launch::async, [&map, pool] {
+        TRACE_THREAD("map prep");
+        TRACE_ZONE("prepare map");
+        bool ok = true;
+        if (options.mapPath)
+            ok = prepareMapFile(options.mapPath, map);
+        else
+            prepareGeneratedMap(options.seed, pool, map);
+        startupTimeline.mark("map_ready");
+        return ok;
+    });
+
     win.end();
     win.show(argc, argv);
-    return Fl::run();
+    startupTimeline.mark("window_shown");
+
+    if (!mapReady.get())
+        return 1;
+    viewer.canvas->installMap(std::move(map));
+    viewer.canvas->setStreaming(options.streaming < 0 ? options.mapPath != nullptr : options.streaming != 0);
+    int status = options.benchPath ? runBenchmarkPaths(*viewer.canvas, options.benchPath, options.benchJson,
+                                                       renderModeName(options.renderMode),
+                                                       farZoomModeName(options.farZoom), options.threads)
+                                   : Fl::run();
+#ifdef TILES_TRACE
+    writeTrace(options.tracePath);
+#endif
+    return status;
 }